@@ -6,9 +6,148 @@
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <string_view>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+#include <charconv>
+#include <cctype>
+#include <bit>
+#include <numeric>
+#include <limits>
+#include <array>
+#include <iomanip>
+#include <tuple>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#endif
+
+struct TerminalEvents {
+    bool focused = true;
+    // Camera movement requested since the last frame, in cells.
+    int pan_x = 0;
+    int pan_y = 0;
+    // Zoom steps requested since the last frame; positive zooms out.
+    int zoom = 0;
+};
+
+// The few console calls the Windows frame path needs. Keeping them behind an
+// interface lets the backend run against a mock on any platform.
+class ConsoleApi {
+public:
+    virtual ~ConsoleApi() = default;
+    // Turns on VT escape processing; false on consoles without it.
+    virtual bool enable_virtual_terminal() = 0;
+    virtual void move_cursor_home() = 0;
+    virtual bool write(const wchar_t* text, size_t length) = 0;
+};
+
+// Writes every frame with a single console call from a buffer reused across
+// frames. With VT processing the cursor is homed and, after a resize, the
+// screen cleared by escape sequences in the same write.
+class ConsoleBackend {
+private:
+    ConsoleApi& api_;
+    std::vector<wchar_t> buffer_;
+    bool virtual_terminal_;
+    bool clear_pending_ = true;
+    
+public:
+    explicit ConsoleBackend(ConsoleApi& api) : api_(api), virtual_terminal_(api.enable_virtual_terminal()) {}
+    
+    bool virtual_terminal() const { return virtual_terminal_; }
+    
+    // The window changed size; wipe leftovers with the next frame.
+    void resized() { clear_pending_ = true; }
+    
+    bool write_frame(std::string_view frame) {
+        constexpr std::string_view CLEAR = "\033[2J";
+        constexpr std::string_view HOME = "\033[H";
+        // Only grows, so steady-state frames do not allocate.
+        size_t needed = CLEAR.size() + HOME.size() + frame.size();
+        if (buffer_.size() < needed) buffer_.resize(needed);
+        
+        size_t length = 0;
+        auto append = [&](std::string_view text) {
+            for (char c : text) buffer_[length++] = static_cast<unsigned char>(c);
+        };
+        if (virtual_terminal_) {
+            if (clear_pending_) append(CLEAR);
+            append(HOME);
+        } else {
+            api_.move_cursor_home();
+        }
+        clear_pending_ = false;
+        append(frame);
+        return api_.write(buffer_.data(), length);
+    }
+};
 
 #ifdef _WIN32
+#define NOMINMAX
 #include <windows.h>
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#define popen _popen
+#define pclose _pclose
+class Win32Console : public ConsoleApi {
+private:
+    HANDLE out_ = GetStdHandle(STD_OUTPUT_HANDLE);
+    // WriteConsoleW fails on files and pipes; redirected output goes
+    // through WriteFile as the bytes the frame was widened from.
+    bool is_console_ = [this] {
+        DWORD mode = 0;
+        return GetConsoleMode(out_, &mode) != 0;
+    }();
+    std::string bytes_;
+    
+public:
+    bool enable_virtual_terminal() override {
+        DWORD mode = 0;
+        if (!GetConsoleMode(out_, &mode)) return false;
+        return SetConsoleMode(out_, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING) != 0;
+    }
+    
+    void move_cursor_home() override {
+        COORD pos = {0, 0};
+        SetConsoleCursorPosition(out_, pos);
+    }
+    
+    bool write(const wchar_t* text, size_t length) override {
+        DWORD written = 0;
+        if (is_console_) {
+            return WriteConsoleW(out_, text, static_cast<DWORD>(length), &written, nullptr) && written == length;
+        }
+        bytes_.resize(length);
+        for (size_t i = 0; i < length; ++i) bytes_[i] = static_cast<char>(text[i]);
+        return WriteFile(out_, bytes_.data(), static_cast<DWORD>(length), &written, nullptr) && written == length;
+    }
+};
+
+ConsoleBackend& console_backend() {
+    static Win32Console api;
+    static ConsoleBackend backend(api);
+    return backend;
+}
+
+void write_frame(std::string_view frame) {
+    console_backend().write_frame(frame);
+}
 void move_cursor_home() {
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
     COORD pos = {0, 0};
@@ -21,8 +160,25 @@ void hide_cursor() {
     cursorInfo.bVisible = FALSE;
     SetConsoleCursorInfo(hOut, &cursorInfo);
 }
+void show_cursor() {
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_CURSOR_INFO cursorInfo;
+    GetConsoleCursorInfo(hOut, &cursorInfo);
+    cursorInfo.bVisible = TRUE;
+    SetConsoleCursorInfo(hOut, &cursorInfo);
+}
 void clear_screen() {
-    system("cls");
+    // The first frame clears through the backend, so only consoles without
+    // VT processing need the screen wiped here.
+    if (console_backend().virtual_terminal()) return;
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo(hOut, &csbi)) return;
+    DWORD cells = static_cast<DWORD>(csbi.dwSize.X) * csbi.dwSize.Y;
+    DWORD written = 0;
+    COORD origin = {0, 0};
+    FillConsoleOutputCharacterW(hOut, L' ', cells, origin, &written);
+    SetConsoleCursorPosition(hOut, origin);
 }
 void get_terminal_size(int& width, int& height) {
     CONSOLE_SCREEN_BUFFER_INFO csbi;
@@ -30,20 +186,134 @@ void get_terminal_size(int& width, int& height) {
     width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
     height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
 }
+// Focus arrives as console input events, so nothing is written to the output.
+void enable_terminal_input(bool) {
+    HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD mode = 0;
+    if (GetConsoleMode(hIn, &mode)) SetConsoleMode(hIn, mode | ENABLE_WINDOW_INPUT);
+}
+void restore_terminal() {
+    show_cursor();
+}
+void poll_terminal_events(TerminalEvents& events) {
+    HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD pending = 0;
+    while (GetNumberOfConsoleInputEvents(hIn, &pending) && pending > 0) {
+        INPUT_RECORD record;
+        DWORD read = 0;
+        if (!ReadConsoleInput(hIn, &record, 1, &read) || read == 0) break;
+        if (record.EventType == FOCUS_EVENT) {
+            events.focused = record.Event.FocusEvent.bSetFocus;
+        } else if (record.EventType == WINDOW_BUFFER_SIZE_EVENT) {
+            console_backend().resized();
+        } else if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown) {
+            switch (record.Event.KeyEvent.wVirtualKeyCode) {
+                case VK_LEFT: case 'A': case 'H': --events.pan_x; break;
+                case VK_RIGHT: case 'D': case 'L': ++events.pan_x; break;
+                case VK_UP: case 'W': case 'K': --events.pan_y; break;
+                case VK_DOWN: case 'S': case 'J': ++events.pan_y; break;
+                case VK_OEM_PLUS: case VK_ADD: --events.zoom; break;
+                case VK_OEM_MINUS: case VK_SUBTRACT: ++events.zoom; break;
+            }
+        }
+    }
+}
 #else
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+termios saved_termios;
+bool termios_saved = false;
+// Escape sequences go to stdout only when frames do.
+bool focus_reporting = false;
+
 void move_cursor_home() {
     std::cout << "\033[H";
 }
+void write_frame(std::string_view frame) {
+    move_cursor_home();
+    std::cout << frame;
+    std::cout.flush();
+}
 void hide_cursor() {
     std::cout << "\033[?25l";
 }
 void clear_screen() {
     std::cout << "\033[2J\033[H";
 }
+void show_cursor() {
+    std::cout << "\033[?25h";
+}
 void get_terminal_size(int& width, int& height) {
     width = 120;
     height = 40;
 }
+void enable_terminal_input(bool interactive) {
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_termios) == 0) {
+        termios raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        termios_saved = true;
+    }
+    // Ask the terminal to report focus in/out as ESC [ I / ESC [ O.
+    focus_reporting = interactive;
+    if (focus_reporting) std::cout << "\033[?1004h";
+}
+void restore_terminal() {
+    if (focus_reporting) {
+        std::cout << "\033[?1004l";
+        show_cursor();
+        std::cout.flush();
+    }
+    if (termios_saved) tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+}
+void poll_terminal_events(TerminalEvents& events) {
+    pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    char buf[64];
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; ++i) {
+            char key = buf[i];
+            if (key == '\033' && i + 2 < n && buf[i + 1] == '[') {
+                // Focus reports and arrow keys share the CSI prefix.
+                switch (buf[i + 2]) {
+                    case 'I': events.focused = true; break;
+                    case 'O': events.focused = false; break;
+                    case 'A': key = 'k'; break;
+                    case 'B': key = 'j'; break;
+                    case 'C': key = 'l'; break;
+                    case 'D': key = 'h'; break;
+                }
+                i += 2;
+            }
+            switch (key) {
+                case 'h': case 'a': --events.pan_x; break;
+                case 'l': case 'd': ++events.pan_x; break;
+                case 'k': case 'w': --events.pan_y; break;
+                case 'j': case 's': ++events.pan_y; break;
+                case '+': case '=': --events.zoom; break;
+                case '-': case '_': ++events.zoom; break;
+            }
+        }
+    }
+}
 #endif
 
 using namespace std;
@@ -54,13 +324,212 @@ namespace {
     
     const string GRADIENT = " .:-=+*#%@";
     
-    mt19937 rng(42);
+    constexpr auto FRAME_DURATION = chrono::milliseconds(50);
+    constexpr int UNFOCUSED_FRAME_INTERVAL = 10;
+    
+    atomic<bool> quit_requested{false};
+    
+    // FNV-1a; cheap enough to run over every finished frame.
+    uint64_t hash_bytes(const string& data, uint64_t hash = 14695981039346656037ull) {
+        for (unsigned char c : data) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
     
-    double random_double(double min_val, double max_val) {
-        uniform_real_distribution<double> dist(min_val, max_val);
-        return dist(rng);
+    double elapsed_ms(chrono::steady_clock::time_point since) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
     }
     
+    struct QualitySettings {
+        int particle_stride;   // accumulate every n-th particle
+        bool twinkle;          // animate background star brightness
+    };
+    
+    constexpr QualitySettings QUALITY_LEVELS[] = {
+        {1, true},
+        {1, false},
+        {2, false},
+        {4, false},
+    };
+    constexpr int MAX_QUALITY_LEVEL = static_cast<int>(size(QUALITY_LEVELS)) - 1;
+    
+    struct RenderStats {
+        double stars_ms = 0;
+        double accumulate_ms = 0;
+        double shade_ms = 0;
+        double output_ms = 0;
+        bool output_skipped = false;
+        // Stage completion times, used for latency tracing.
+        chrono::steady_clock::time_point accumulated;
+        chrono::steady_clock::time_point shaded;
+        chrono::steady_clock::time_point written;
+        
+        double total_ms() const { return stars_ms + accumulate_ms + shade_ms + output_ms; }
+    };
+    
+    // Log-linear histogram of latencies in microseconds: four buckets per
+    // power of two, so a reported percentile is within 25% of the truth.
+    class LatencyHistogram {
+    private:
+        static constexpr int SUB_BUCKETS = 4;
+        static constexpr int BUCKETS = 40 * SUB_BUCKETS;
+        
+        array<uint64_t, BUCKETS> counts_{};
+        uint64_t total_ = 0;
+        double sum_us_ = 0;
+        double max_us_ = 0;
+        
+        static int bucket(uint64_t us) {
+            if (us < SUB_BUCKETS) return static_cast<int>(us);
+            int exponent = bit_width(us) - 1;
+            int mantissa = static_cast<int>((us >> (exponent - 2)) & (SUB_BUCKETS - 1));
+            return min(BUCKETS - 1, (exponent - 1) * SUB_BUCKETS + mantissa);
+        }
+        
+        static double upper_bound_us(int index) {
+            if (index < SUB_BUCKETS) return index + 1;
+            int exponent = index / SUB_BUCKETS + 1;
+            int mantissa = index % SUB_BUCKETS;
+            return static_cast<double>(uint64_t(SUB_BUCKETS + mantissa + 1) << (exponent - 2));
+        }
+        
+    public:
+        void record(double us) {
+            ++counts_[bucket(static_cast<uint64_t>(max(us, 0.0)))];
+            ++total_;
+            sum_us_ += us;
+            max_us_ = max(max_us_, us);
+        }
+        
+        uint64_t count() const { return total_; }
+        double mean_us() const { return total_ ? sum_us_ / total_ : 0; }
+        double max_us() const { return max_us_; }
+        
+        double percentile_us(double p) const {
+            uint64_t rank = static_cast<uint64_t>(ceil(p / 100.0 * total_));
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; ++i) {
+                seen += counts_[i];
+                if (seen >= max<uint64_t>(rank, 1)) return min(upper_bound_us(i), max_us_);
+            }
+            return max_us_;
+        }
+    };
+    
+    // Follows each displayed frame from the simulation tick that produced its
+    // state to the completion of the terminal write.
+    class LatencyTracer {
+    public:
+        struct Trace {
+            uint64_t frame;
+            double sim_time;
+            chrono::steady_clock::time_point ticked;
+            chrono::steady_clock::time_point accumulated;
+            chrono::steady_clock::time_point shaded;
+            chrono::steady_clock::time_point written;
+        };
+        
+    private:
+        chrono::steady_clock::time_point origin_;
+        LatencyHistogram end_to_end_;
+        LatencyHistogram queued_;      // tick -> accumulation done
+        LatencyHistogram shading_;     // accumulation -> shading done
+        LatencyHistogram writing_;     // shading -> write done
+        unique_ptr<ofstream> log_;
+        
+        static double us_between(chrono::steady_clock::time_point a, chrono::steady_clock::time_point b) {
+            return chrono::duration<double, micro>(b - a).count();
+        }
+        
+    public:
+        explicit LatencyTracer(chrono::steady_clock::time_point origin) : origin_(origin) {}
+        
+        // Writes one CSV row per traced frame, timestamps in microseconds since start.
+        bool open_log(const string& path) {
+            log_ = make_unique<ofstream>(path);
+            *log_ << "frame,sim_time,ticked_us,accumulated_us,shaded_us,written_us,latency_us\n";
+            return static_cast<bool>(*log_);
+        }
+        
+        void record(const Trace& t) {
+            double latency = us_between(t.ticked, t.written);
+            end_to_end_.record(latency);
+            queued_.record(us_between(t.ticked, t.accumulated));
+            shading_.record(us_between(t.accumulated, t.shaded));
+            writing_.record(us_between(t.shaded, t.written));
+            
+            if (log_) {
+                *log_ << t.frame << ',' << t.sim_time << ',' << us_between(origin_, t.ticked) << ','
+                      << us_between(origin_, t.accumulated) << ',' << us_between(origin_, t.shaded) << ','
+                      << us_between(origin_, t.written) << ',' << latency << '\n';
+            }
+        }
+        
+        string hud() const {
+            ostringstream out;
+            out << fixed << setprecision(1) << "  Latency p50/p99: " << end_to_end_.percentile_us(50) / 1000
+                << "/" << end_to_end_.percentile_us(99) / 1000 << " ms";
+            return out.str();
+        }
+        
+        void report(ostream& out) const {
+            auto line = [&](const char* name, const LatencyHistogram& h) {
+                out << "  " << left << setw(12) << name << right << fixed << setprecision(2)
+                    << setw(10) << h.mean_us() / 1000 << setw(10) << h.percentile_us(50) / 1000
+                    << setw(10) << h.percentile_us(99) / 1000 << setw(10) << h.max_us() / 1000 << '\n';
+            };
+            out << "Frame latency over " << end_to_end_.count() << " frames (ms)\n"
+                << "  " << left << setw(12) << "stage" << right << setw(10) << "mean" << setw(10) << "p50"
+                << setw(10) << "p99" << setw(10) << "max" << '\n';
+            line("tick->accum", queued_);
+            line("accum->shade", shading_);
+            line("shade->write", writing_);
+            line("end-to-end", end_to_end_);
+        }
+    };
+    
+    // Picks a quality level that keeps the measured frame cost under budget.
+    // Degrading reacts within a few frames, recovering needs a long calm
+    // streak so the level does not oscillate around the threshold.
+    class QualityController {
+    private:
+        double budget_ms_;
+        double smoothed_ms_ = 0;
+        int level_ = 0;
+        int over_frames_ = 0;
+        int under_frames_ = 0;
+        
+        static constexpr double SMOOTHING = 0.2;
+        static constexpr double DEGRADE_RATIO = 0.9;
+        static constexpr double RECOVER_RATIO = 0.5;
+        static constexpr int DEGRADE_FRAMES = 5;
+        static constexpr int RECOVER_FRAMES = 40;
+        
+    public:
+        explicit QualityController(double budget_ms) : budget_ms_(budget_ms) {}
+        
+        void report(const RenderStats& stats) {
+            double cost = stats.total_ms();
+            smoothed_ms_ = smoothed_ms_ == 0 ? cost : smoothed_ms_ + SMOOTHING * (cost - smoothed_ms_);
+            
+            over_frames_ = smoothed_ms_ > budget_ms_ * DEGRADE_RATIO ? over_frames_ + 1 : 0;
+            under_frames_ = smoothed_ms_ < budget_ms_ * RECOVER_RATIO ? under_frames_ + 1 : 0;
+            
+            if (over_frames_ >= DEGRADE_FRAMES && level_ < MAX_QUALITY_LEVEL) {
+                ++level_;
+                over_frames_ = 0;
+            } else if (under_frames_ >= RECOVER_FRAMES && level_ > 0) {
+                --level_;
+                under_frames_ = 0;
+            }
+        }
+        
+        int level() const { return level_; }
+        double smoothed_ms() const { return smoothed_ms_; }
+    };
+    
     struct Vec2 {
         double x, y;
         
@@ -78,229 +547,4519 @@ namespace {
         Vec2 perpendicular() const { return {-y, x}; }
     };
     
-    struct Particle {
-        Vec2 pos;
-        double angle;
-        double radius;
-        double angular_velocity;
-        double brightness;
+    // Particles kept as parallel columns so every kernel streams the fields
+    // it needs linearly; mapped catalogs use the same layout.
+    struct ParticleStore {
+        vector<double> radius;
+        vector<double> angle;
+        vector<double> angular_velocity;
+        vector<double> brightness;
         
-        Particle(double r, double a, double av, double b)
-            : radius(r), angle(a), angular_velocity(av), brightness(b) {}
+        size_t size() const { return radius.size(); }
         
-        void update(double dt) {
-            angle += angular_velocity * dt;
-            if (angle > TWO_PI) angle -= TWO_PI;
-            if (angle < 0) angle += TWO_PI;
+        void push_back(double r, double a, double av, double b) {
+            radius.push_back(r);
+            angle.push_back(a);
+            angular_velocity.push_back(av);
+            brightness.push_back(b);
         }
         
-        Vec2 get_position(const Vec2& center, double aspect) const {
-            return {
-                center.x + radius * cos(angle) * aspect,
-                center.y + radius * sin(angle)
-            };
+        void append(const ParticleStore& other) {
+            radius.insert(radius.end(), other.radius.begin(), other.radius.end());
+            angle.insert(angle.end(), other.angle.begin(), other.angle.end());
+            angular_velocity.insert(angular_velocity.end(), other.angular_velocity.begin(),
+                                    other.angular_velocity.end());
+            brightness.insert(brightness.end(), other.brightness.begin(), other.brightness.end());
         }
-    };
-    
-    struct Star {
-        Vec2 pos;
-        double phase;
-        double speed;
-        double base_brightness;
         
-        void update(double dt) {
-            phase += speed * dt;
-            if (phase > TWO_PI) phase -= TWO_PI;
+        void reserve(size_t n) {
+            radius.reserve(n);
+            angle.reserve(n);
+            angular_velocity.reserve(n);
+            brightness.reserve(n);
         }
         
-        double get_brightness() const {
-            return base_brightness * (0.3 + 0.7 * (0.5 + 0.5 * sin(phase)));
+        void update(double dt, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                double a = angle[i] + angular_velocity[i] * dt;
+                if (a > TWO_PI) a -= TWO_PI;
+                if (a < 0) a += TWO_PI;
+                angle[i] = a;
+            }
         }
     };
     
-    class Galaxy {
-    private:
-        vector<Particle> particles_;
-        vector<Star> stars_;
-        Vec2 center_;
-        int width_, height_;
-        double time_;
-        double aspect_ratio_;
+#ifdef __wasm_simd128__
+    // WebAssembly SIMD128 variants of the particle kernels. They match the
+    // scalar loops except that projection runs in single precision, which
+    // can move a particle sitting on a cell border to its neighbour.
+    void update_angles_simd128(double* angle, const double* angular_velocity, size_t count, double dt) {
+        const v128_t step = wasm_f64x2_splat(dt);
+        const v128_t two_pi = wasm_f64x2_splat(TWO_PI);
+        const v128_t zero = wasm_f64x2_splat(0.0);
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            v128_t a = wasm_f64x2_add(wasm_v128_load(angle + i),
+                                      wasm_f64x2_mul(wasm_v128_load(angular_velocity + i), step));
+            a = wasm_f64x2_sub(a, wasm_v128_and(two_pi, wasm_f64x2_gt(a, two_pi)));
+            a = wasm_f64x2_add(a, wasm_v128_and(two_pi, wasm_f64x2_lt(a, zero)));
+            wasm_v128_store(angle + i, a);
+        }
+        for (; i < count; ++i) {
+            double a = angle[i] + angular_velocity[i] * dt;
+            if (a > TWO_PI) a -= TWO_PI;
+            if (a < 0) a += TWO_PI;
+            angle[i] = a;
+        }
+    }
+    
+    // Four doubles narrowed into one f32x4.
+    inline v128_t load_f32x4(const double* p) {
+        v128_t lo = wasm_f32x4_demote_f64x2_zero(wasm_v128_load(p));
+        v128_t hi = wasm_f32x4_demote_f64x2_zero(wasm_v128_load(p + 2));
+        return wasm_i32x4_shuffle(lo, hi, 0, 1, 4, 5);
+    }
+    
+    // Quadrant reduction with a three-part pi/2, then short polynomials;
+    // good to about 2e-7 over [0, 2pi).
+    inline void sincos_f32x4(v128_t x, v128_t& sin_out, v128_t& cos_out) {
+        v128_t q = wasm_f32x4_nearest(wasm_f32x4_mul(x, wasm_f32x4_splat(0.636619772f)));
+        v128_t r = wasm_f32x4_sub(x, wasm_f32x4_mul(q, wasm_f32x4_splat(1.5703125f)));
+        r = wasm_f32x4_sub(r, wasm_f32x4_mul(q, wasm_f32x4_splat(4.837512969970703125e-4f)));
+        r = wasm_f32x4_sub(r, wasm_f32x4_mul(q, wasm_f32x4_splat(7.54978995489188216e-8f)));
+        v128_t r2 = wasm_f32x4_mul(r, r);
         
-    public:
-        Galaxy(int w, int h) : width_(w), height_(h), time_(0) {
-            center_ = {w / 2.0, h / 2.0};
-            aspect_ratio_ = 2.0;
+        v128_t sin_poly = wasm_f32x4_add(wasm_f32x4_splat(8.3321608736e-3f),
+                                         wasm_f32x4_mul(r2, wasm_f32x4_splat(-1.9515295891e-4f)));
+        sin_poly = wasm_f32x4_add(wasm_f32x4_splat(-1.6666654611e-1f), wasm_f32x4_mul(r2, sin_poly));
+        v128_t sin_r = wasm_f32x4_add(r, wasm_f32x4_mul(wasm_f32x4_mul(r, r2), sin_poly));
+        
+        v128_t cos_poly = wasm_f32x4_add(wasm_f32x4_splat(-1.388731625493765e-3f),
+                                         wasm_f32x4_mul(r2, wasm_f32x4_splat(2.443315711809948e-5f)));
+        cos_poly = wasm_f32x4_add(wasm_f32x4_splat(4.166664568298827e-2f), wasm_f32x4_mul(r2, cos_poly));
+        v128_t cos_r = wasm_f32x4_add(wasm_f32x4_sub(wasm_f32x4_splat(1.0f), wasm_f32x4_mul(r2, wasm_f32x4_splat(0.5f))),
+                                      wasm_f32x4_mul(wasm_f32x4_mul(r2, r2), cos_poly));
+        
+        // Odd quadrants swap sin and cos; bit 1 of q (and of q + 1) flips signs.
+        v128_t quadrant = wasm_i32x4_trunc_sat_f32x4(q);
+        v128_t one = wasm_i32x4_splat(1);
+        v128_t two = wasm_i32x4_splat(2);
+        v128_t swap = wasm_i32x4_eq(wasm_v128_and(quadrant, one), one);
+        v128_t sin_sign = wasm_i32x4_shl(wasm_v128_and(quadrant, two), 30);
+        v128_t cos_sign = wasm_i32x4_shl(wasm_v128_and(wasm_i32x4_add(quadrant, one), two), 30);
+        sin_out = wasm_v128_xor(wasm_v128_bitselect(cos_r, sin_r, swap), sin_sign);
+        cos_out = wasm_v128_xor(wasm_v128_bitselect(sin_r, cos_r, swap), cos_sign);
+    }
+    
+    // Same as Galaxy::cell_index and Galaxy::cell_margin for a run of
+    // particles: flat cell index, or -1 off the plane, and the angle each
+    // can turn before that may change.
+    void project_cells_simd128(const double* radius, const double* angle, size_t count, double center_x,
+                               double center_y, double scale_x, double scale_y, int width, int height,
+                               int32_t* out, float* margins) {
+        const v128_t cx = wasm_f32x4_splat(static_cast<float>(center_x));
+        const v128_t cy = wasm_f32x4_splat(static_cast<float>(center_y));
+        const v128_t sx = wasm_f32x4_splat(static_cast<float>(scale_x));
+        const v128_t sy = wasm_f32x4_splat(static_cast<float>(scale_y));
+        const v128_t w = wasm_i32x4_splat(width);
+        const v128_t h = wasm_i32x4_splat(height);
+        const v128_t zero = wasm_i32x4_splat(0);
+        const v128_t outside = wasm_i32x4_splat(-1);
+        const v128_t one = wasm_f32x4_splat(1.0f);
+        const v128_t none = wasm_f32x4_splat(0.0f);
+        const v128_t left = wasm_f32x4_splat(-1.0f);
+        const v128_t right = wasm_f32x4_splat(static_cast<float>(width));
+        const v128_t bottom = wasm_f32x4_splat(static_cast<float>(height));
+        // Float positions are coarser than Galaxy::cell_margin's doubles.
+        const v128_t slack = wasm_f32x4_splat(1.0f / 64);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            v128_t r = load_f32x4(radius + i);
+            v128_t s, c;
+            sincos_f32x4(load_f32x4(angle + i), s, c);
+            v128_t reach_x = wasm_f32x4_abs(wasm_f32x4_mul(r, sx));
+            v128_t reach_y = wasm_f32x4_abs(wasm_f32x4_mul(r, sy));
+            v128_t x = wasm_f32x4_add(cx, wasm_f32x4_mul(wasm_f32x4_mul(r, c), sx));
+            v128_t y = wasm_f32x4_add(cy, wasm_f32x4_mul(wasm_f32x4_mul(r, s), sy));
+            v128_t px = wasm_i32x4_trunc_sat_f32x4(x);
+            v128_t py = wasm_i32x4_trunc_sat_f32x4(y);
+            v128_t inside = wasm_v128_and(wasm_v128_and(wasm_i32x4_ge(px, zero), wasm_i32x4_lt(px, w)),
+                                          wasm_v128_and(wasm_i32x4_ge(py, zero), wasm_i32x4_lt(py, h)));
+            v128_t cell = wasm_i32x4_add(wasm_i32x4_mul(py, w), px);
+            wasm_v128_store(out + i, wasm_v128_bitselect(cell, outside, inside));
             
-            init_spiral_arms();
-            init_core();
-            init_background_stars();
+            v128_t fx = wasm_f32x4_sub(x, wasm_f32x4_floor(x));
+            v128_t fy = wasm_f32x4_sub(y, wasm_f32x4_floor(y));
+            v128_t border_x = wasm_f32x4_min(fx, wasm_f32x4_sub(one, fx));
+            v128_t border_y = wasm_f32x4_min(fy, wasm_f32x4_sub(one, fy));
+            v128_t plane_x = wasm_f32x4_max(none, wasm_f32x4_max(wasm_f32x4_sub(left, x), wasm_f32x4_sub(x, right)));
+            v128_t plane_y = wasm_f32x4_max(none, wasm_f32x4_max(wasm_f32x4_sub(left, y), wasm_f32x4_sub(y, bottom)));
+            v128_t in_margin = wasm_f32x4_min(wasm_f32x4_div(wasm_f32x4_sub(border_x, slack), reach_x),
+                                              wasm_f32x4_div(wasm_f32x4_sub(border_y, slack), reach_y));
+            v128_t out_margin = wasm_f32x4_max(wasm_f32x4_div(wasm_f32x4_sub(plane_x, slack), reach_x),
+                                               wasm_f32x4_div(wasm_f32x4_sub(plane_y, slack), reach_y));
+            wasm_v128_store(margins + i, wasm_v128_bitselect(in_margin, out_margin, inside));
+        }
+        // The tail is re-projected every frame.
+        for (; i < count; ++i) {
+            int px = static_cast<int>(center_x + radius[i] * cos(angle[i]) * scale_x);
+            int py = static_cast<int>(center_y + radius[i] * sin(angle[i]) * scale_y);
+            out[i] = px >= 0 && px < width && py >= 0 && py < height ? py * width + px : -1;
+            margins[i] = 0.0f;
         }
+    }
+#endif
+    
+    // Visible stars, one column per field. Phases are fixed point with a
+    // full turn at 2^32, so advancing them wraps for free; speeds are turns
+    // per second in 16.16 and time is taken in 1/65536 s ticks, so the
+    // product is the phase advance modulo a turn at any time.
+    struct StarBatch {
+        static constexpr int LUT_BITS = 10;
         
-        void update(double dt) {
-            time_ += dt;
-            
-            for (auto& p : particles_) {
-                p.update(dt);
+        vector<float> x, y;
+        vector<uint32_t> phase;
+        vector<uint32_t> speed;
+        vector<float> base;
+        vector<float> brightness;
+        
+        size_t size() const { return x.size(); }
+        
+        void clear() {
+            x.clear();
+            y.clear();
+            phase.clear();
+            speed.clear();
+            base.clear();
+        }
+        
+        void push_back(float px, float py, uint32_t star_phase, uint32_t star_speed, float star_base) {
+            x.push_back(px);
+            y.push_back(py);
+            phase.push_back(star_phase);
+            speed.push_back(star_speed);
+            base.push_back(star_base);
+        }
+        
+        // 0.3 + 0.7 * (0.5 + 0.5 * sin) over one turn.
+        static const array<float, 1 << LUT_BITS>& twinkle_table() {
+            static const auto table = [] {
+                array<float, 1 << LUT_BITS> t{};
+                for (size_t i = 0; i < t.size(); ++i) {
+                    t[i] = static_cast<float>(0.3 + 0.7 * (0.5 + 0.5 * sin(TWO_PI * i / t.size())));
+                }
+                return t;
+            }();
+            return table;
+        }
+        
+        // Branch-free pass over every star: integer phase advance and a
+        // table lookup instead of a sin call.
+        void evaluate(double time, bool twinkle) {
+            const size_t n = size();
+            brightness.resize(n);
+            if (!twinkle) {
+                for (size_t i = 0; i < n; ++i) brightness[i] = base[i] * 0.65f;
+                return;
             }
-            
-            for (auto& s : stars_) {
-                s.update(dt);
+            const float* table = twinkle_table().data();
+            const uint32_t ticks = static_cast<uint32_t>(static_cast<uint64_t>(time * 65536.0));
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t p = phase[i] + speed[i] * ticks;
+                brightness[i] = base[i] * table[p >> (32 - LUT_BITS)];
             }
         }
+    };
+    
+    // splitmix64 finalizer.
+    uint64_t mix_hash(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+    
+    // Background stars derived from a hash of the tile they fall in, so no
+    // per-star state exists and only tiles overlapping the view are ever
+    // evaluated. Farther layers shift less when the camera pans.
+    class Starfield {
+    private:
+        struct Layer {
+            double parallax;
+            int max_per_tile;
+            double brightness;
+        };
         
-        void render(double real_elapsed_sec = 0) const {
-            vector<string> screen(height_, string(width_, ' '));
-            vector<vector<double>> intensity(height_, vector<double>(width_, 0));
-            
-            render_stars(screen);
-            accumulate_particles(intensity);
-            apply_intensity(screen, intensity);
-            render_core(screen);
-            
-            output(screen, real_elapsed_sec);
+        static constexpr int TILE_W = 16;
+        static constexpr int TILE_H = 8;
+        static constexpr Layer LAYERS[] = {
+            {0.1, 2, 0.6},
+            {0.3, 2, 0.8},
+            {0.6, 1, 1.0},
+        };
+        
+        uint64_t seed_;
+        int layers_;
+        
+        static double unit(uint64_t bits, int shift, int width) {
+            return ((bits >> shift) & ((uint64_t(1) << width) - 1)) / static_cast<double>(uint64_t(1) << width);
         }
         
-    private:
-        void init_spiral_arms() {
-            constexpr int num_arms = 2;
-            constexpr int particles_per_arm = 150;
-            
-            for (int arm = 0; arm < num_arms; ++arm) {
-                double arm_offset = arm * PI;
+    public:
+        static constexpr int MAX_LAYERS = static_cast<int>(size(LAYERS));
+        
+        Starfield(uint64_t seed, int layers) : seed_(mix_hash(seed)), layers_(clamp(layers, 0, MAX_LAYERS)) {}
+        
+        // Appends the stars overlapping the view to batch, in screen cells.
+        void collect(const Vec2& camera, int width, int height, StarBatch& batch) const {
+            for (int l = 0; l < layers_; ++l) {
+                const Layer& layer = LAYERS[l];
+                double ox = camera.x * layer.parallax;
+                double oy = camera.y * layer.parallax;
                 
-                for (int i = 0; i < particles_per_arm; ++i) {
-                    double t = i / static_cast<double>(particles_per_arm);
-                    double base_radius = 2.0 + t * 14.0;
-                    double spiral_angle = arm_offset + t * 2.5 * PI;
-                    
-                    double radius_variation = random_double(-1.0, 1.0) * (0.5 + t * 1.5);
-                    double angle_variation = random_double(-0.2, 0.2);
-                    
-                    double radius = base_radius + radius_variation;
-                    double angle = spiral_angle + angle_variation;
-                    
-                    double angular_velocity = 0.15 / sqrt(radius);
-                    double brightness = 0.3 + 0.7 * (1.0 - t * 0.6);
-                    
-                    particles_.emplace_back(radius, angle, angular_velocity, brightness);
+                int tx0 = static_cast<int>(floor(ox / TILE_W));
+                int tx1 = static_cast<int>(floor((ox + width) / TILE_W));
+                int ty0 = static_cast<int>(floor(oy / TILE_H));
+                int ty1 = static_cast<int>(floor((oy + height) / TILE_H));
+                
+                for (int ty = ty0; ty <= ty1; ++ty) {
+                    for (int tx = tx0; tx <= tx1; ++tx) {
+                        uint64_t tile = mix_hash(seed_ ^ (uint64_t(l) << 60) ^
+                                                 (uint64_t(uint32_t(tx)) << 28) ^ uint32_t(ty));
+                        int count = static_cast<int>(tile % (layer.max_per_tile + 1));
+                        
+                        for (int k = 0; k < count; ++k) {
+                            uint64_t bits = mix_hash(tile + k + 1);
+                            double speed = 0.5 + 1.5 * unit(bits, 44, 8);
+                            batch.push_back(static_cast<float>(tx * TILE_W + unit(bits, 0, 16) * TILE_W - ox),
+                                            static_cast<float>(ty * TILE_H + unit(bits, 16, 16) * TILE_H - oy),
+                                            static_cast<uint32_t>((bits >> 32) & 0xFFF) << 20,
+                                            static_cast<uint32_t>(lround(speed / TWO_PI * 65536.0)),
+                                            static_cast<float>((0.3 + 0.7 * unit(bits, 52, 12)) * layer.brightness));
+                        }
+                    }
                 }
             }
         }
+    };
+    
+    // Hardware counters around a code region via perf_event_open. Every
+    // counter is opened on its own so a missing event (common in VMs and
+    // containers) only blanks that column; when nothing opens the report
+    // falls back to timings. Counters are inherited, so they also cover
+    // threads created after construction: open them before the ThreadPool
+    // whose work they should count.
+    class PerfCounters {
+    public:
+        static constexpr size_t COUNT = 5;
+        static constexpr const char* NAMES[COUNT] = {"cycles", "instructions", "L1D-miss", "LLC-miss", "br-miss"};
+        using Values = array<uint64_t, COUNT>;
         
-        void init_core() {
-            constexpr int core_particles = 60;
-            
-            for (int i = 0; i < core_particles; ++i) {
-                double radius = random_double(0.5, 3.0);
-                double angle = random_double(0, TWO_PI);
-                double angular_velocity = 0.3 / sqrt(radius + 0.5);
-                double brightness = 0.8 + random_double(0, 0.2);
-                
-                particles_.emplace_back(radius, angle, angular_velocity, brightness);
+    private:
+        array<int, COUNT> fds_;
+        string error_;
+        
+    public:
+        explicit PerfCounters(bool enabled) {
+            fds_.fill(-1);
+            if (!enabled) return;
+#ifdef __linux__
+            const pair<uint32_t, uint64_t> events[COUNT] = {
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            };
+            for (size_t i = 0; i < COUNT; ++i) {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.type = events[i].first;
+                attr.config = events[i].second;
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.inherit = 1;
+                fds_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                if (fds_[i] < 0 && error_.empty()) error_ = strerror(errno);
             }
+#else
+            error_ = "perf_event is Linux only";
+#endif
         }
         
-        void init_background_stars() {
-            constexpr int num_stars = 80;
-            
-            for (int i = 0; i < num_stars; ++i) {
-                Star s;
-                s.pos = {random_double(0, width_), random_double(0, height_)};
-                s.phase = random_double(0, TWO_PI);
-                s.speed = random_double(0.5, 2.0);
-                s.base_brightness = random_double(0.3, 1.0);
-                stars_.push_back(s);
+        ~PerfCounters() {
+#ifdef __linux__
+            for (int fd : fds_) if (fd >= 0) close(fd);
+#endif
+        }
+        
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+        
+        bool available(size_t i) const { return fds_[i] >= 0; }
+        bool any_available() const {
+            return any_of(fds_.begin(), fds_.end(), [](int fd) { return fd >= 0; });
+        }
+        const string& error() const { return error_; }
+        
+        void start() {
+#ifdef __linux__
+            for (int fd : fds_) {
+                if (fd < 0) continue;
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
             }
+#endif
         }
         
-        void render_stars(vector<string>& screen) const {
-            for (const auto& s : stars_) {
-                int sx = static_cast<int>(s.pos.x);
-                int sy = static_cast<int>(s.pos.y);
-                
-                if (sx >= 0 && sx < width_ && sy >= 0 && sy < height_) {
-                    double b = s.get_brightness();
-                    if (b > 0.7) screen[sy][sx] = '*';
-                    else if (b > 0.4) screen[sy][sx] = '+';
-                    else if (b > 0.2) screen[sy][sx] = '.';
-                }
+        // Adds the counts since start() to totals.
+        void stop(Values& totals) {
+#ifdef __linux__
+            for (size_t i = 0; i < COUNT; ++i) {
+                if (fds_[i] < 0) continue;
+                ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+                uint64_t value = 0;
+                if (read(fds_[i], &value, sizeof(value)) == sizeof(value)) totals[i] += value;
+            }
+#else
+            (void)totals;
+#endif
+        }
+    };
+    
+    // Fixed set of workers running one parallel_for at a time. The caller
+    // takes part in the work and returns once every index has been handled.
+    class ThreadPool {
+    private:
+        vector<thread> workers_;
+        mutex mutex_;
+        condition_variable wake_;
+        condition_variable done_;
+        const function<void(size_t)>* task_ = nullptr;
+        size_t task_count_ = 0;
+        atomic<size_t> next_index_{0};
+        size_t pending_workers_ = 0;
+        uint64_t generation_ = 0;
+        bool stopping_ = false;
+        
+        void drain() {
+            for (size_t i = next_index_++; i < task_count_; i = next_index_++) {
+                (*task_)(i);
             }
         }
         
-        void accumulate_particles(vector<vector<double>>& intensity) const {
-            for (const auto& p : particles_) {
-                Vec2 pos = p.get_position(center_, aspect_ratio_);
-                int px = static_cast<int>(pos.x);
-                int py = static_cast<int>(pos.y);
+        void worker_loop() {
+            uint64_t seen = 0;
+            unique_lock<mutex> lock(mutex_);
+            while (true) {
+                wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+                if (stopping_) return;
+                seen = generation_;
                 
-                if (px >= 0 && px < width_ && py >= 0 && py < height_) {
-                    intensity[py][px] += p.brightness;
-                }
+                lock.unlock();
+                drain();
+                lock.lock();
+                
+                if (--pending_workers_ == 0) done_.notify_one();
             }
         }
         
-        void apply_intensity(vector<string>& screen, const vector<vector<double>>& intensity) const {
-            for (int y = 0; y < height_; ++y) {
-                for (int x = 0; x < width_; ++x) {
-                    if (intensity[y][x] > 0.1) {
-                        int idx = static_cast<int>(intensity[y][x] * 3.0);
-                        idx = clamp(idx, 0, static_cast<int>(GRADIENT.length()) - 1);
-                        screen[y][x] = GRADIENT[idx];
-                    }
-                }
+    public:
+        explicit ThreadPool(size_t threads) {
+            for (size_t i = 1; i < max<size_t>(threads, 1); ++i) {
+                workers_.emplace_back([this] { worker_loop(); });
             }
         }
         
-        void render_core(vector<string>& screen) const {
-            int cx = static_cast<int>(center_.x);
-            int cy = static_cast<int>(center_.y);
-            
-            if (cx > 0 && cx < width_ - 1 && cy >= 0 && cy < height_) {
-                screen[cy][cx] = '@';
-                screen[cy][cx - 1] = '(';
-                screen[cy][cx + 1] = ')';
+        ~ThreadPool() {
+            {
+                lock_guard<mutex> lock(mutex_);
+                stopping_ = true;
             }
+            wake_.notify_all();
+            for (auto& w : workers_) w.join();
         }
         
-        void output(const vector<string>& screen, double real_elapsed_sec) const {
-            move_cursor_home();
-            ostringstream buffer;
-            
-            for (const auto& line : screen) {
-                buffer << line << '\n';
+        size_t size() const { return workers_.size() + 1; }
+        
+        // Slices below this many items are not worth a task.
+        static constexpr size_t GRAIN = 16384;
+        
+        // Tasks for count items: one per thread, none smaller than grain,
+        // and a single one without a pool.
+        static size_t tasks_for(const ThreadPool* pool, size_t count, size_t grain = GRAIN) {
+            return pool ? clamp<size_t>(count / grain, 1, pool->size()) : 1;
+        }
+        
+        // Slice `task` of `tasks` even slices of [0, count). Starts round up
+        // to a multiple of align, so a strided pass over the slices visits
+        // the same items as a serial one.
+        static pair<size_t, size_t> range(size_t task, size_t tasks, size_t count, size_t align = 1) {
+            auto bound = [&](size_t t) { return min(count, (count * t / tasks + align - 1) / align * align); };
+            return {bound(task), bound(task + 1)};
+        }
+        
+        // Runs body(task, begin, end) over tasks_for(pool, count, grain)
+        // slices, inline when there is only one; returns the slice count.
+        static size_t parallel_ranges(ThreadPool* pool, size_t count, size_t grain,
+                                      const function<void(size_t, size_t, size_t)>& body, size_t align = 1) {
+            const size_t tasks = tasks_for(pool, count, grain);
+            auto slice = [&](size_t t) {
+                auto [begin, end] = range(t, tasks, count, align);
+                body(t, begin, end);
+            };
+            if (tasks == 1) slice(0);
+            else pool->parallel_for(tasks, slice);
+            return tasks;
+        }
+        
+        void parallel_for(size_t count, const function<void(size_t)>& fn) {
+            {
+                lock_guard<mutex> lock(mutex_);
+                task_ = &fn;
+                task_count_ = count;
+                next_index_ = 0;
+                pending_workers_ = workers_.size();
+                ++generation_;
             }
+            wake_.notify_all();
+            drain();
             
-            buffer << "\n Time: " << static_cast<int>(real_elapsed_sec) << "s";
-            cout << buffer.str();
-            cout.flush();
+            unique_lock<mutex> lock(mutex_);
+            done_.wait(lock, [&] { return pending_workers_ == 0; });
         }
     };
-}
-
-int main() {
-    hide_cursor();
-    clear_screen();
-    
-    int term_width, term_height;
-    get_terminal_size(term_width, term_height);
-    
-    int width = min(term_width, 120);
-    int height = min(term_height - 3, 35);
-    
-    Galaxy galaxy(width, height);
-    
-    constexpr double dt = 0.1;
-    constexpr auto frame_duration = chrono::milliseconds(50);
-    auto start_time = chrono::steady_clock::now();
     
-    while (true) {
-        auto now = chrono::steady_clock::now();
-        double real_elapsed = chrono::duration<double>(now - start_time).count();
-        galaxy.render(real_elapsed);
-        galaxy.update(dt);
-        this_thread::sleep_for(frame_duration);
+    // Parallel LSD radix sort of 32-bit keys that also permutes any number
+    // of parallel columns, e.g. a particle store's SoA arrays. Sorts on the
+    // low `bits` bits, eight per pass, stably. The passes move only (key,
+    // u32 index) pairs; each column is gathered through the final
+    // permutation once, instead of riding along in every scatter. Sorted
+    // buffers are swapped into the caller's vectors, so the scratch is
+    // reused across calls and nothing is copied back.
+    template <typename... Columns>
+    class RadixSort {
+    private:
+        static constexpr int RADIX_BITS = 8;
+        static constexpr size_t BUCKETS = size_t(1) << RADIX_BITS;
+        static constexpr bool HAS_COLUMNS = sizeof...(Columns) > 0;
+        
+        vector<uint32_t> key_scratch_;
+        // index_[k] is where the k-th sorted key started out.
+        vector<uint32_t> index_;
+        vector<uint32_t> index_scratch_;
+        tuple<vector<Columns>...> column_scratch_;
+        // Per task, one row of bucket counts, later turned into write cursors.
+        vector<size_t> offsets_;
+        
+    public:
+        void sort(ThreadPool* pool, int bits, vector<uint32_t>& keys, vector<Columns>&... columns) {
+            const size_t count = keys.size();
+            // Every pass splits the keys the same way, so each task's
+            // histogram row matches the slice it later scatters.
+            const size_t tasks = ThreadPool::tasks_for(pool, count);
+            
+            key_scratch_.resize(count);
+            if constexpr (HAS_COLUMNS) {
+                index_.resize(count);
+                index_scratch_.resize(count);
+            }
+            offsets_.resize(tasks * BUCKETS);
+            
+            // Until a pass moves something the permutation is the identity,
+            // which the first scatter reads as i instead of from index_.
+            bool permuted = false;
+            for (int shift = 0; shift < bits; shift += RADIX_BITS) {
+                const uint32_t* in_keys = keys.data();
+                ThreadPool::parallel_ranges(pool, count, ThreadPool::GRAIN, [&](size_t t, size_t begin, size_t end) {
+                    size_t* histogram = &offsets_[t * BUCKETS];
+                    fill(histogram, histogram + BUCKETS, 0);
+                    for (size_t i = begin; i < end; ++i) ++histogram[(in_keys[i] >> shift) & (BUCKETS - 1)];
+                });
+                
+                // Bucket-major prefix sum; a digit every key shares leaves
+                // the order as it is, so that pass is skipped.
+                size_t total = 0;
+                bool trivial = false;
+                for (size_t b = 0; b < BUCKETS; ++b) {
+                    size_t bucket_start = total;
+                    for (size_t t = 0; t < tasks; ++t) {
+                        size_t n = offsets_[t * BUCKETS + b];
+                        offsets_[t * BUCKETS + b] = total;
+                        total += n;
+                    }
+                    trivial = trivial || total - bucket_start == count;
+                }
+                if (trivial) continue;
+                
+                uint32_t* out_keys = key_scratch_.data();
+                const uint32_t* in_index = index_.data();
+                uint32_t* out_index = index_scratch_.data();
+                ThreadPool::parallel_ranges(pool, count, ThreadPool::GRAIN, [&](size_t t, size_t begin, size_t end) {
+                    size_t* next = &offsets_[t * BUCKETS];
+                    for (size_t i = begin; i < end; ++i) {
+                        size_t dst = next[(in_keys[i] >> shift) & (BUCKETS - 1)]++;
+                        out_keys[dst] = in_keys[i];
+                        if constexpr (HAS_COLUMNS) {
+                            out_index[dst] = permuted ? in_index[i] : static_cast<uint32_t>(i);
+                        }
+                    }
+                });
+                keys.swap(key_scratch_);
+                index_.swap(index_scratch_);
+                permuted = true;
+            }
+            
+            if constexpr (HAS_COLUMNS) {
+                if (!permuted) return;
+                // One column per pass keeps a single random read stream.
+                const uint32_t* index = index_.data();
+                auto gather = [&](auto& column, auto& scratch) {
+                    scratch.resize(count);
+                    ThreadPool::parallel_ranges(pool, count, ThreadPool::GRAIN, [&](size_t, size_t begin, size_t end) {
+                        for (size_t k = begin; k < end; ++k) scratch[k] = column[index[k]];
+                    });
+                    column.swap(scratch);
+                };
+                [&]<size_t... I>(index_sequence<I...>) {
+                    (gather(columns, get<I>(column_scratch_)), ...);
+                }(index_sequence_for<Columns...>{});
+            }
+        }
+    };
+    
+    constexpr size_t CACHE_LINE = 64;
+    
+    inline void cpu_relax() {
+#if defined(_MSC_VER)
+        YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+    
+    // Wait strategies for the blocking queue operations. wait() is called
+    // with the index or sequence word that has to move before the caller can
+    // proceed; notify() is called after the other side moved it.
+    struct SpinWait {
+        static constexpr const char* NAME = "spin";
+        
+        template <typename W>
+        static void wait(const atomic<W>&, W, int& spins) {
+            // Yield now and then so a spinning thread cannot starve its peer
+            // on an oversubscribed machine.
+            if (++spins % 256 == 0) this_thread::yield();
+            else cpu_relax();
+        }
+        
+        template <typename W>
+        static void notify(atomic<W>&) {}
+    };
+    
+    // Spins briefly, then yields, then sleeps in the kernel on the word
+    // (std::atomic::wait is a futex on Linux and WaitOnAddress on Windows).
+    struct FutexBackoffWait {
+        static constexpr const char* NAME = "futex";
+        
+        template <typename W>
+        static void wait(const atomic<W>& word, W observed, int& spins) {
+            ++spins;
+            if (spins < 64) cpu_relax();
+            else if (spins < 96) this_thread::yield();
+            else word.wait(observed, memory_order_acquire);
+        }
+        
+        template <typename W>
+        static void notify(atomic<W>& word) { word.notify_all(); }
+    };
+    
+    inline size_t round_up_pow2(size_t n) { return bit_ceil(max<size_t>(n, 2)); }
+    
+    // Bounded single-producer single-consumer ring. Each side caches the
+    // other side's index so the shared lines are only touched when the
+    // cached view runs out; batches publish their items with one store.
+    template <typename T, typename Wait = FutexBackoffWait>
+    class SpscQueue {
+    private:
+        alignas(CACHE_LINE) atomic<size_t> head_{0};   // next slot to pop
+        alignas(CACHE_LINE) size_t cached_tail_ = 0;   // consumer's view of tail_
+        alignas(CACHE_LINE) atomic<size_t> tail_{0};   // next slot to push
+        alignas(CACHE_LINE) size_t cached_head_ = 0;   // producer's view of head_
+        alignas(CACHE_LINE) vector<T> slots_;
+        size_t mask_;
+        
+    public:
+        explicit SpscQueue(size_t capacity) : slots_(round_up_pow2(capacity)), mask_(slots_.size() - 1) {}
+        
+        size_t capacity() const { return slots_.size(); }
+        
+        size_t try_push_batch(T* items, size_t count) {
+            size_t tail = tail_.load(memory_order_relaxed);
+            size_t free_slots = capacity() - (tail - cached_head_);
+            if (free_slots < count) {
+                cached_head_ = head_.load(memory_order_acquire);
+                free_slots = capacity() - (tail - cached_head_);
+            }
+            size_t n = min(count, free_slots);
+            for (size_t i = 0; i < n; ++i) slots_[(tail + i) & mask_] = move(items[i]);
+            if (n > 0) {
+                tail_.store(tail + n, memory_order_release);
+                Wait::notify(tail_);
+            }
+            return n;
+        }
+        
+        size_t try_pop_batch(T* out, size_t max_count) {
+            size_t head = head_.load(memory_order_relaxed);
+            size_t available = cached_tail_ - head;
+            if (available < max_count) {
+                cached_tail_ = tail_.load(memory_order_acquire);
+                available = cached_tail_ - head;
+            }
+            size_t n = min(max_count, available);
+            for (size_t i = 0; i < n; ++i) out[i] = move(slots_[(head + i) & mask_]);
+            if (n > 0) {
+                head_.store(head + n, memory_order_release);
+                Wait::notify(head_);
+            }
+            return n;
+        }
+        
+        bool try_push(T item) { return try_push_batch(&item, 1) == 1; }
+        bool try_pop(T& out) { return try_pop_batch(&out, 1) == 1; }
+        
+        void push_batch(T* items, size_t count) {
+            int spins = 0;
+            while (count > 0) {
+                size_t observed = head_.load(memory_order_relaxed);
+                size_t n = try_push_batch(items, count);
+                items += n;
+                count -= n;
+                if (n == 0) Wait::wait(head_, observed, spins);
+                else spins = 0;
+            }
+        }
+        
+        // Blocks until at least one item is available.
+        size_t pop_batch(T* out, size_t max_count) {
+            int spins = 0;
+            while (true) {
+                size_t observed = tail_.load(memory_order_relaxed);
+                size_t n = try_pop_batch(out, max_count);
+                if (n > 0) return n;
+                Wait::wait(tail_, observed, spins);
+            }
+        }
+        
+        void push(T item) { push_batch(&item, 1); }
+        
+        T pop() {
+            T item;
+            pop_batch(&item, 1);
+            return item;
+        }
+    };
+    
+    // Bounded multi-producer multi-consumer ring (Vyukov): every cell
+    // carries a sequence number telling whose turn it is. Batches claim a
+    // run of consecutive ready cells with a single CAS.
+    template <typename T, typename Wait = FutexBackoffWait>
+    class MpmcQueue {
+    private:
+        struct alignas(CACHE_LINE) Cell {
+            atomic<size_t> sequence;
+            T value;
+        };
+        
+        alignas(CACHE_LINE) atomic<size_t> enqueue_pos_{0};
+        alignas(CACHE_LINE) atomic<size_t> dequeue_pos_{0};
+        alignas(CACHE_LINE) unique_ptr<Cell[]> cells_;
+        size_t mask_;
+        
+        // Claims up to max_count cells whose sequence equals position + lag.
+        size_t claim(atomic<size_t>& position, size_t lag, size_t max_count, size_t& first) {
+            size_t pos = position.load(memory_order_relaxed);
+            while (true) {
+                size_t n = 0;
+                while (n < max_count &&
+                       cells_[(pos + n) & mask_].sequence.load(memory_order_acquire) == pos + n + lag) {
+                    ++n;
+                }
+                if (n == 0) {
+                    // Either the queue is full/empty or pos is stale.
+                    size_t current = position.load(memory_order_relaxed);
+                    if (current == pos) return 0;
+                    pos = current;
+                    continue;
+                }
+                if (position.compare_exchange_weak(pos, pos + n, memory_order_relaxed)) {
+                    first = pos;
+                    return n;
+                }
+            }
+        }
+        
+    public:
+        explicit MpmcQueue(size_t capacity)
+            : cells_(make_unique<Cell[]>(round_up_pow2(capacity))), mask_(round_up_pow2(capacity) - 1) {
+            for (size_t i = 0; i <= mask_; ++i) cells_[i].sequence.store(i, memory_order_relaxed);
+        }
+        
+        size_t capacity() const { return mask_ + 1; }
+        
+        size_t try_push_batch(T* items, size_t count) {
+            size_t first;
+            size_t n = claim(enqueue_pos_, 0, count, first);
+            for (size_t i = 0; i < n; ++i) {
+                Cell& cell = cells_[(first + i) & mask_];
+                cell.value = move(items[i]);
+                cell.sequence.store(first + i + 1, memory_order_release);
+                Wait::notify(cell.sequence);
+            }
+            return n;
+        }
+        
+        size_t try_pop_batch(T* out, size_t max_count) {
+            size_t first;
+            size_t n = claim(dequeue_pos_, 1, max_count, first);
+            for (size_t i = 0; i < n; ++i) {
+                Cell& cell = cells_[(first + i) & mask_];
+                out[i] = move(cell.value);
+                cell.sequence.store(first + i + capacity(), memory_order_release);
+                Wait::notify(cell.sequence);
+            }
+            return n;
+        }
+        
+        bool try_push(T item) { return try_push_batch(&item, 1) == 1; }
+        bool try_pop(T& out) { return try_pop_batch(&out, 1) == 1; }
+        
+        void push_batch(T* items, size_t count) {
+            int spins = 0;
+            while (count > 0) {
+                size_t n = try_push_batch(items, count);
+                items += n;
+                count -= n;
+                if (n > 0) {
+                    spins = 0;
+                    continue;
+                }
+                // Sleep only on a genuinely full cell; any other sequence
+                // means pos went stale and the claim should simply retry.
+                size_t pos = enqueue_pos_.load(memory_order_relaxed);
+                Cell& cell = cells_[pos & mask_];
+                size_t observed = cell.sequence.load(memory_order_acquire);
+                if (observed + capacity() == pos + 1) Wait::wait(cell.sequence, observed, spins);
+            }
+        }
+        
+        size_t pop_batch(T* out, size_t max_count) {
+            int spins = 0;
+            while (true) {
+                size_t n = try_pop_batch(out, max_count);
+                if (n > 0) return n;
+                size_t pos = dequeue_pos_.load(memory_order_relaxed);
+                Cell& cell = cells_[pos & mask_];
+                size_t observed = cell.sequence.load(memory_order_acquire);
+                if (observed == pos) Wait::wait(cell.sequence, observed, spins);
+            }
+        }
+        
+        void push(T item) { push_batch(&item, 1); }
+        
+        T pop() {
+            T item;
+            pop_batch(&item, 1);
+            return item;
+        }
+    };
+    
+    struct IntensityPlane {
+        int width = 0;
+        int height = 0;
+        vector<float> cells;
+        
+        IntensityPlane(int w, int h) : width(w), height(h), cells(static_cast<size_t>(w) * h, 0.0f) {}
+        
+        float& at(int x, int y) { return cells[static_cast<size_t>(y) * width + x]; }
+        float at(int x, int y) const { return cells[static_cast<size_t>(y) * width + x]; }
+        
+        void add(const IntensityPlane& other) {
+            for (size_t i = 0; i < cells.size(); ++i) cells[i] += other.cells[i];
+        }
+    };
+    
+#ifndef _WIN32
+    // Read-only mapping of a whole file. Empty files map to an empty view.
+    class MappedFile {
+    private:
+        void* base_ = MAP_FAILED;
+        size_t length_ = 0;
+        
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        
+        ~MappedFile() {
+            if (base_ != MAP_FAILED) munmap(base_, length_);
+        }
+        
+        static unique_ptr<MappedFile> open(const string& path, int advice = MADV_SEQUENTIAL) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return nullptr;
+            
+            struct stat st;
+            auto file = make_unique<MappedFile>();
+            bool ok = fstat(fd, &st) == 0;
+            if (ok && st.st_size > 0) {
+                file->length_ = st.st_size;
+                file->base_ = mmap(nullptr, file->length_, PROT_READ, MAP_PRIVATE, fd, 0);
+                ok = file->base_ != MAP_FAILED;
+            }
+            close(fd);
+            if (!ok) return nullptr;
+            if (file->length_ > 0) madvise(file->base_, file->length_, advice);
+            return file;
+        }
+        
+        const char* data() const { return length_ > 0 ? static_cast<const char*>(base_) : nullptr; }
+        size_t size() const { return length_; }
+        string_view view() const { return {data(), length_}; }
+        
+        // Advises the pages overlapping [first, last).
+        static void advise(const void* first, const void* last, int advice) {
+            static const uintptr_t page = sysconf(_SC_PAGESIZE);
+            uintptr_t lo = reinterpret_cast<uintptr_t>(first) & ~(page - 1);
+            uintptr_t hi = reinterpret_cast<uintptr_t>(last);
+            if (hi > lo) madvise(reinterpret_cast<void*>(lo), hi - lo, advice);
+        }
+    };
+    
+    // Read-only mapping of a particle catalog file:
+    //   "SPCAT001", u64 count, then four float32 columns of count entries
+    //   (radius, angle, angular velocity, brightness), little endian.
+    // Frames stream through it chunk by chunk, reading ahead and dropping
+    // pages behind, so catalogs larger than RAM stay viewable.
+    struct MappedCatalog {
+        static constexpr size_t CHUNK = size_t(1) << 18;
+        static constexpr size_t HEADER_SIZE = 16;
+        
+        unique_ptr<MappedFile> file;
+        size_t count = 0;
+        const float* radius = nullptr;
+        const float* angle = nullptr;
+        const float* angular_velocity = nullptr;
+        const float* brightness = nullptr;
+        
+        static shared_ptr<MappedCatalog> open(const string& path) { return from(MappedFile::open(path)); }
+        
+        // Takes over an existing mapping; null unless it holds a catalog.
+        static shared_ptr<MappedCatalog> from(unique_ptr<MappedFile> file) {
+            if (!file || file->size() < HEADER_SIZE) return nullptr;
+            const char* bytes = file->data();
+            uint64_t count = 0;
+            memcpy(&count, bytes + 8, sizeof(count));
+            if (memcmp(bytes, "SPCAT001", 8) != 0 || count > (file->size() - HEADER_SIZE) / (4 * sizeof(float))) {
+                return nullptr;
+            }
+            
+            auto catalog = make_shared<MappedCatalog>();
+            const float* columns = reinterpret_cast<const float*>(bytes + HEADER_SIZE);
+            catalog->file = move(file);
+            catalog->count = count;
+            catalog->radius = columns;
+            catalog->angle = columns + count;
+            catalog->angular_velocity = columns + 2 * count;
+            catalog->brightness = columns + 3 * count;
+            return catalog;
+        }
+        
+        void prefetch(size_t begin, size_t end) const { advise(begin, end, MADV_WILLNEED); }
+        void release(size_t begin, size_t end) const { advise(begin, end, MADV_DONTNEED); }
+        
+    private:
+        void advise(size_t begin, size_t end, int advice) const {
+            end = min(end, count);
+            if (begin >= end) return;
+            for (const float* column : {radius, angle, angular_velocity, brightness}) {
+                MappedFile::advise(column + begin, column + end, advice);
+            }
+        }
+    };
+#endif
+    
+    // Consistent copies of the simulation state for readers on other
+    // threads (rasterizer, recorder, network, metrics). Two buffers each
+    // guarded by a sequence counter: the writer fills the buffer readers are
+    // not pointed at, then flips, so it never waits for anyone. A reader
+    // retries only if the writer lapped it twice during its copy. Payload
+    // words are release-stored and acquire-loaded (plain moves on x86)
+    // instead of relying on fences, so the scheme is race-free in the C++
+    // memory model and fully understood by TSan.
+    class SnapshotPublisher {
+    public:
+        struct Snapshot {
+            uint64_t step = 0;
+            double time = 0;
+            double checksum = 0;    // sum of angles, lets readers detect tearing
+            vector<double> angle;
+        };
+        
+    private:
+        struct Buffer {
+            atomic<uint64_t> sequence{0};
+            uint64_t step = 0;
+            double time = 0;
+            double checksum = 0;
+            vector<double> angle;
+        };
+        
+        alignas(CACHE_LINE) Buffer buffers_[2];
+        alignas(CACHE_LINE) atomic<uint32_t> latest_{0};
+        alignas(CACHE_LINE) atomic<uint64_t> retries_{0};
+        
+        template <typename T>
+        static void store(T& slot, T value) { atomic_ref<T>(slot).store(value, memory_order_release); }
+        
+        template <typename T>
+        static T load(T& slot) { return atomic_ref<T>(slot).load(memory_order_acquire); }
+        
+    public:
+        explicit SnapshotPublisher(size_t particles) {
+            for (Buffer& b : buffers_) b.angle.assign(particles, 0.0);
+        }
+        
+        size_t size() const { return buffers_[0].angle.size(); }
+        uint64_t retries() const { return retries_.load(memory_order_relaxed); }
+        
+        // Single writer only.
+        void publish(uint64_t step, double time, const vector<double>& angle) {
+            uint32_t next = latest_.load(memory_order_relaxed) ^ 1;
+            Buffer& b = buffers_[next];
+            // The acquire exchange keeps the payload stores below from
+            // becoming visible before the buffer is marked busy.
+            uint64_t sequence = b.sequence.fetch_add(1, memory_order_acquire);
+            
+            size_t n = min(angle.size(), b.angle.size());
+            double checksum = 0;
+            for (size_t i = 0; i < n; ++i) {
+                store(b.angle[i], angle[i]);
+                checksum += angle[i];
+            }
+            store(b.step, step);
+            store(b.time, time);
+            store(b.checksum, checksum);
+            
+            b.sequence.store(sequence + 2, memory_order_release);
+            latest_.store(next, memory_order_release);
+        }
+        
+        void read(Snapshot& out) {
+            out.angle.resize(size());
+            while (true) {
+                Buffer& b = buffers_[latest_.load(memory_order_acquire)];
+                uint64_t before = b.sequence.load(memory_order_acquire);
+                if ((before & 1) == 0) {
+                    for (size_t i = 0; i < out.angle.size(); ++i) out.angle[i] = load(b.angle[i]);
+                    out.step = load(b.step);
+                    out.time = load(b.time);
+                    out.checksum = load(b.checksum);
+                    if (b.sequence.load(memory_order_relaxed) == before) return;
+                }
+                retries_.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    };
+    
+    // dst = 2x2 block sums of src; an odd last row or column is dropped.
+    void downsample_2x(const IntensityPlane& src, IntensityPlane& dst) {
+        for (int y = 0; y < dst.height; ++y) {
+            const float* r0 = &src.cells[static_cast<size_t>(2 * y) * src.width];
+            const float* r1 = r0 + src.width;
+            float* out = &dst.cells[static_cast<size_t>(y) * dst.width];
+            int x = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+            // Four output cells per step: add the rows, then pair up even
+            // and odd columns with shuffles.
+            for (; x + 4 <= dst.width; x += 4) {
+                __m128 a = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x), _mm_loadu_ps(r1 + 2 * x));
+                __m128 b = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x + 4), _mm_loadu_ps(r1 + 2 * x + 4));
+                __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                _mm_storeu_ps(out + x, _mm_add_ps(even, odd));
+            }
+#endif
+            for (; x < dst.width; ++x) {
+                out[x] = r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1];
+            }
+        }
+    }
+    
+    // Mip chain over one accumulation pass: each level sums 2x2 blocks of
+    // the one below, preserving total brightness, so every level shades
+    // directly as a zoomed-out view, a thumbnail or a smaller viewport.
+    class IntensityPyramid {
+    private:
+        vector<IntensityPlane> levels_;
+        
+    public:
+        // Returns the cleared full-resolution level to accumulate into.
+        IntensityPlane& reset(int width, int height) {
+            if (levels_.empty() || levels_[0].width != width || levels_[0].height != height) {
+                levels_.assign(1, IntensityPlane(width, height));
+            } else {
+                fill(levels_[0].cells.begin(), levels_[0].cells.end(), 0.0f);
+            }
+            return levels_[0];
+        }
+        
+        // Derives levels 1..count-1 from level 0.
+        void build(int count) {
+            levels_.erase(levels_.begin() + 1, levels_.end());
+            for (int k = 1; k < count; ++k) {
+                const IntensityPlane& below = levels_[k - 1];
+                if (below.width < 2 || below.height < 2) break;
+                IntensityPlane next(below.width / 2, below.height / 2);
+                downsample_2x(below, next);
+                levels_.push_back(move(next));
+            }
+        }
+        
+        int levels() const { return static_cast<int>(levels_.size()); }
+        const IntensityPlane& level(int k) const { return levels_[k]; }
+    };
+    
+    // Receives finished frames. Sinks take ownership of the buffer, so a
+    // backend can queue or hand it to another thread without copying.
+    class OutputSink {
+    public:
+        virtual ~OutputSink() = default;
+        virtual void write(string&& frame) = 0;
+        // False once the destination has gone away, e.g. a closed socket.
+        virtual bool good() const { return true; }
+        // Whether frames are drawn on this process's terminal.
+        virtual bool interactive() const { return false; }
+    };
+    
+    class TtySink : public OutputSink {
+    public:
+        void write(string&& frame) override { write_frame(frame); }
+        bool interactive() const override { return true; }
+    };
+    
+    // Discards frames; keeps the renderer honest in benchmarks.
+    class NullSink : public OutputSink {
+    private:
+        uint64_t frames_ = 0;
+        uint64_t bytes_ = 0;
+        
+    public:
+        void write(string&& frame) override {
+            ++frames_;
+            bytes_ += frame.size();
+        }
+        uint64_t frames() const { return frames_; }
+        uint64_t bytes() const { return bytes_; }
+    };
+    
+    // Byte-stream sinks emit what a terminal would get, cursor homing
+    // included, so `cat` on a recording or `nc` on a socket replays it.
+    constexpr string_view FRAME_PREFIX = "\033[H";
+    
+    class FileSink : public OutputSink {
+    private:
+        ofstream out_;
+        
+    public:
+        explicit FileSink(const string& path) : out_(path, ios::binary) {}
+        
+        void write(string&& frame) override {
+            out_ << FRAME_PREFIX << frame;
+            out_.flush();
+        }
+        bool good() const override { return static_cast<bool>(out_); }
+    };
+    
+    // Feeds frames to a shell command's standard input.
+    class PipeSink : public OutputSink {
+    private:
+        FILE* pipe_;
+        bool good_;
+        
+    public:
+        explicit PipeSink(const string& command) : pipe_(popen(command.c_str(), "w")), good_(pipe_ != nullptr) {}
+        ~PipeSink() override { if (pipe_) pclose(pipe_); }
+        
+        void write(string&& frame) override {
+            if (!good_) return;
+            good_ = fwrite(FRAME_PREFIX.data(), 1, FRAME_PREFIX.size(), pipe_) == FRAME_PREFIX.size() &&
+                    fwrite(frame.data(), 1, frame.size(), pipe_) == frame.size() && fflush(pipe_) == 0;
+        }
+        bool good() const override { return good_; }
+    };
+    
+#ifndef _WIN32
+    // Streams frames to a TCP listener.
+    class SocketSink : public OutputSink {
+    private:
+        int fd_ = -1;
+        
+    public:
+        SocketSink(const string& host, const string& port) {
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* results = nullptr;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &results) != 0) return;
+            for (addrinfo* ai = results; ai && fd_ < 0; ai = ai->ai_next) {
+                fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+                if (fd_ >= 0 && connect(fd_, ai->ai_addr, ai->ai_addrlen) != 0) {
+                    close(fd_);
+                    fd_ = -1;
+                }
+            }
+            freeaddrinfo(results);
+        }
+        ~SocketSink() override { if (fd_ >= 0) close(fd_); }
+        
+        void write(string&& frame) override {
+            if (fd_ < 0) return;
+            iovec parts[] = {{const_cast<char*>(FRAME_PREFIX.data()), FRAME_PREFIX.size()},
+                             {frame.data(), frame.size()}};
+            size_t remaining = FRAME_PREFIX.size() + frame.size();
+            while (remaining > 0) {
+                ssize_t n = writev(fd_, parts, 2);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    close(fd_);
+                    fd_ = -1;
+                    return;
+                }
+                remaining -= n;
+                // Advance past whatever the kernel took.
+                for (iovec& part : parts) {
+                    size_t taken = min<size_t>(n, part.iov_len);
+                    part.iov_base = static_cast<char*>(part.iov_base) + taken;
+                    part.iov_len -= taken;
+                    n -= taken;
+                }
+            }
+        }
+        bool good() const override { return fd_ >= 0; }
+    };
+#endif
+    
+    // SPEC is tty, null, file:PATH, pipe:COMMAND or tcp:HOST:PORT.
+    unique_ptr<OutputSink> open_output(const string& spec) {
+        unique_ptr<OutputSink> sink;
+        auto colon = spec.find(':');
+        string kind = spec.substr(0, colon);
+        string target = colon == string::npos ? "" : spec.substr(colon + 1);
+        
+        if (spec == "tty") {
+            sink = make_unique<TtySink>();
+        } else if (spec == "null") {
+            sink = make_unique<NullSink>();
+        } else if (kind == "file" && !target.empty()) {
+            sink = make_unique<FileSink>(target);
+        } else if (kind == "pipe" && !target.empty()) {
+#ifndef _WIN32
+            signal(SIGPIPE, SIG_IGN);
+#endif
+            sink = make_unique<PipeSink>(target);
+#ifndef _WIN32
+        } else if (kind == "tcp" && target.rfind(':') != string::npos) {
+            signal(SIGPIPE, SIG_IGN);
+            auto port = target.rfind(':');
+            sink = make_unique<SocketSink>(target.substr(0, port), target.substr(port + 1));
+#endif
+        }
+        if (sink && !sink->good()) sink.reset();
+        return sink;
+    }
+    
+    // Uniform-grid cell list for fixed-radius neighbour queries over the
+    // square [-extent, extent]^2; points outside clamp to the border cells.
+    // build() counting-sorts the points by cell (RadixSort on the cell
+    // index) into one contiguous array, so cell c holds the points
+    // order()[start(c)] .. order()[start(c + 1) - 1] and there are no
+    // per-cell containers. Callers that permute their own columns by
+    // order() can then treat sorted positions as indices, which keeps each
+    // query's reads contiguous.
+    class CellList {
+    private:
+        double extent_;
+        double cell_size_;
+        int dim_;
+        vector<uint32_t> keys_;
+        vector<uint32_t> order_;
+        vector<uint32_t> cell_start_;
+        RadixSort<uint32_t> sorter_;
+        
+        int coord(double v) const {
+            return clamp(static_cast<int>((v + extent_) / cell_size_), 0, dim_ - 1);
+        }
+        
+    public:
+        // A neighbour query costs about as much as a few dozen streamed
+        // items, so query loops split into finer slices than ThreadPool::GRAIN.
+        static constexpr size_t QUERY_GRAIN = 4096;
+        static constexpr int MAX_DIM = 2048;
+        
+        // Cells are at least radius wide, so every point within radius of
+        // a query lies in the 3x3 block of cells around it.
+        CellList(double extent, double radius)
+            : extent_(extent),
+              cell_size_(max(radius, 2 * extent / MAX_DIM)),
+              dim_(max(1, static_cast<int>(ceil(2 * extent / cell_size_)))),
+              cell_start_(static_cast<size_t>(dim_) * dim_ + 1) {}
+        
+        double radius() const { return cell_size_; }
+        size_t cells() const { return cell_start_.size() - 1; }
+        size_t size() const { return order_.size(); }
+        size_t cell(double x, double y) const { return static_cast<size_t>(coord(y)) * dim_ + coord(x); }
+        const vector<uint32_t>& order() const { return order_; }
+        uint32_t start(size_t cell) const { return cell_start_[cell]; }
+        
+        void build(ThreadPool* pool, const double* x, const double* y, size_t count) {
+            keys_.resize(count);
+            order_.resize(count);
+            ThreadPool::parallel_ranges(pool, count, ThreadPool::GRAIN, [&](size_t, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    keys_[i] = static_cast<uint32_t>(cell(x[i], y[i]));
+                    order_[i] = static_cast<uint32_t>(i);
+                }
+            });
+            sorter_.sort(pool, bit_width(static_cast<uint32_t>(cells() - 1)), keys_, order_);
+            
+            // Every cell from just past the previous key up to this one
+            // starts here; runs of equal keys write nothing.
+            ThreadPool::parallel_ranges(pool, count, ThreadPool::GRAIN, [&](size_t, size_t begin, size_t end) {
+                for (size_t k = begin; k < end; ++k) {
+                    uint32_t first = k == 0 ? 0 : keys_[k - 1] + 1;
+                    for (uint32_t c = first; c <= keys_[k]; ++c) cell_start_[c] = static_cast<uint32_t>(k);
+                }
+            });
+            const size_t tail = count == 0 ? 0 : keys_.back() + 1;
+            ThreadPool::parallel_ranges(pool, cell_start_.size() - tail, ThreadPool::GRAIN,
+                                        [&](size_t, size_t begin, size_t end) {
+                fill(cell_start_.begin() + tail + begin, cell_start_.begin() + tail + end, static_cast<uint32_t>(count));
+            });
+        }
+        
+        // Calls visit(begin, end) with the sorted positions of the 3x3 cells
+        // around (x, y): a grid row's three cells are adjacent in order(), so
+        // each row is one contiguous range.
+        template <typename Visit>
+        void for_each_candidate_range(double x, double y, Visit&& visit) const {
+            int cx = coord(x);
+            int cy = coord(y);
+            int gx0 = max(cx - 1, 0);
+            int gx1 = min(cx + 1, dim_ - 1);
+            for (int gy = max(cy - 1, 0); gy <= min(cy + 1, dim_ - 1); ++gy) {
+                size_t row = static_cast<size_t>(gy) * dim_;
+                visit(cell_start_[row + gx0], cell_start_[row + gx1 + 1]);
+            }
+        }
+        
+        // Calls visit(k, dx, dy, r2) for every sorted position k whose point
+        // lies within radius (at most radius()) of (x, y); sorted_x/sorted_y
+        // are coordinates already permuted by order(). Read-only, so any
+        // number of threads may query at once.
+        template <typename Visit>
+        void for_each_within(const double* sorted_x, const double* sorted_y, double x, double y, double radius,
+                             Visit&& visit) const {
+            const double r2_max = radius * radius;
+            for_each_candidate_range(x, y, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t k = begin; k < end; ++k) {
+                    double dx = x - sorted_x[k];
+                    double dy = y - sorted_y[k];
+                    double r2 = dx * dx + dy * dy;
+                    if (r2 < r2_max) visit(k, dx, dy, r2);
+                }
+            });
+        }
+    };
+    
+    // Smoothed-particle hydrodynamics gas orbiting in the same potential as
+    // the stars. Neighbours come from a uniform grid of cells one smoothing
+    // length wide, rebuilt every step, so each particle only visits the 3x3
+    // cells around it and a step stays O(N). Positions are world units
+    // centred on the galaxy.
+    class GasLayer {
+    private:
+        static constexpr double DISK_RADIUS = 16.0;
+        // The grid spans twice the disk; stragglers clamp to its edge cells.
+        static constexpr double GRID_RADIUS = 2 * DISK_RADIUS;
+        static constexpr double NEIGHBOURS = 30.0;
+        static constexpr double REST_DENSITY = 1.0;
+        // Squared sound speed; kept well below orbital speeds.
+        static constexpr double STIFFNESS = 0.01;
+        static constexpr double VISCOSITY = 0.02;
+        // The stars orbit at 0.15 * sqrt(r), i.e. a constant inward pull
+        // of 0.15^2.
+        static constexpr double GRAVITY = 0.0225;
+        // Intensity of gas at rest density, per screen cell.
+        static constexpr double LIGHT = 0.35;
+        
+        vector<double> x_, y_, vx_, vy_, ax_, ay_, density_, pressure_;
+        double h_;
+        double mass_;
+        CellList cells_;
+        vector<double> scratch_;
+        
+        // Sorts by cell, then permutes the state columns into that order so
+        // every neighbour scan reads contiguous memory and sorted positions
+        // are particle indices.
+        void build_grid(ThreadPool* pool) {
+            const size_t n = size();
+            cells_.build(pool, x_.data(), y_.data(), n);
+            const vector<uint32_t>& order = cells_.order();
+            for (auto* column : {&x_, &y_, &vx_, &vy_}) {
+                ThreadPool::parallel_ranges(pool, n, ThreadPool::GRAIN, [&](size_t, size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; ++k) scratch_[k] = (*column)[order[k]];
+                });
+                column->swap(scratch_);
+            }
+        }
+        
+        // Calls visit(j, dx, dy, r2) for every particle within h of particle i.
+        template <typename Visit>
+        void for_each_neighbour(size_t i, Visit&& visit) const {
+            cells_.for_each_within(x_.data(), y_.data(), x_[i], y_[i], h_, visit);
+        }
+        
+        // Smoothing length for about NEIGHBOURS neighbours at rest density.
+        static double smoothing_length(size_t count) {
+            return sqrt(NEIGHBOURS * DISK_RADIUS * DISK_RADIUS / max<size_t>(count, 1));
+        }
+        
+        // 2D poly6 density, then a clamped linear equation of state.
+        void compute_density(ThreadPool* pool) {
+            const double h2 = h_ * h_;
+            const double poly6 = 4.0 / (PI * pow(h_, 8));
+            ThreadPool::parallel_ranges(pool, size(), CellList::QUERY_GRAIN, [&](size_t, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    double rho = 0;
+                    for_each_neighbour(i, [&](size_t, double, double, double r2) {
+                        double q = h2 - r2;
+                        rho += q * q * q;
+                    });
+                    density_[i] = mass_ * poly6 * rho;
+                    pressure_[i] = STIFFNESS * max(density_[i] - REST_DENSITY, 0.0);
+                }
+            });
+        }
+        
+        // Spiky-kernel pressure gradient, viscosity and the galactic pull.
+        void compute_forces(ThreadPool* pool) {
+            const double spiky = -30.0 / (PI * pow(h_, 5));
+            const double viscous = 40.0 / (PI * pow(h_, 5));
+            ThreadPool::parallel_ranges(pool, size(), CellList::QUERY_GRAIN, [&](size_t, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    double ax = 0, ay = 0;
+                    for_each_neighbour(i, [&](size_t j, double dx, double dy, double r2) {
+                        if (j == i) return;
+                        double r = sqrt(r2) + 1e-12;
+                        double q = h_ - r;
+                        double push = -mass_ * (pressure_[i] + pressure_[j]) / (2 * density_[j]) * spiky * q * q / r;
+                        double drag = VISCOSITY * mass_ / density_[j] * viscous * q;
+                        ax += push * dx + drag * (vx_[j] - vx_[i]);
+                        ay += push * dy + drag * (vy_[j] - vy_[i]);
+                    });
+                    double r = hypot(x_[i], y_[i]);
+                    // Fade the pull to zero at the centre instead of flipping.
+                    double pull = GRAVITY * min(r, 0.5) / 0.5 / max(r, 1e-9);
+                    ax_[i] = ax / density_[i] - pull * x_[i];
+                    ay_[i] = ay / density_[i] - pull * y_[i];
+                }
+            });
+        }
+        
+    public:
+        // count particles spread over the stellar disk on circular orbits.
+        GasLayer(size_t count, uint32_t seed)
+            : h_(smoothing_length(count)),
+              mass_(REST_DENSITY * PI * DISK_RADIUS * DISK_RADIUS / max<size_t>(count, 1)),
+              cells_(GRID_RADIUS, h_) {
+            mt19937 rng(seed);
+            uniform_real_distribution<double> unit(0.0, 1.0);
+            for (auto* column : {&x_, &y_, &vx_, &vy_, &ax_, &ay_, &density_, &pressure_}) column->resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                double r = 1.0 + (DISK_RADIUS - 1.0) * sqrt(unit(rng));
+                double a = unit(rng) * TWO_PI;
+                double v = 0.15 * sqrt(r);
+                x_[i] = r * cos(a);
+                y_[i] = r * sin(a);
+                vx_[i] = -v * sin(a);
+                vy_[i] = v * cos(a);
+            }
+            
+            scratch_.resize(count);
+            build_grid(nullptr);
+            compute_density(nullptr);
+        }
+        
+        size_t size() const { return x_.size(); }
+        
+        void step(double dt, ThreadPool* pool) {
+            // Keep every substep under a quarter smoothing length of sound
+            // travel so the pressure response stays stable.
+            const double max_dt = 0.25 * h_ / sqrt(STIFFNESS);
+            const int substeps = max(1, static_cast<int>(ceil(dt / max_dt)));
+            const double h = dt / substeps;
+            for (int s = 0; s < substeps; ++s) {
+                build_grid(pool);
+                compute_density(pool);
+                compute_forces(pool);
+                ThreadPool::parallel_ranges(pool, size(), ThreadPool::GRAIN, [&](size_t, size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; ++i) {
+                        vx_[i] += ax_[i] * h;
+                        vy_[i] += ay_[i] * h;
+                        x_[i] += vx_[i] * h;
+                        y_[i] += vy_[i] * h;
+                    }
+                });
+            }
+        }
+        
+        // Splats every particle bilinearly over the four nearest cells,
+        // weighted by its density, so the gas reads as a soft glow once
+        // shaded by apply_intensity.
+        void accumulate(IntensityPlane& intensity, const Vec2& center, double scale_x, double scale_y) const {
+            const double weight = LIGHT * mass_ / REST_DENSITY * scale_x * scale_y;
+            for (size_t i = 0; i < size(); ++i) {
+                double px = center.x + x_[i] * scale_x - 0.5;
+                double py = center.y + y_[i] * scale_y - 0.5;
+                int x0 = static_cast<int>(floor(px));
+                int y0 = static_cast<int>(floor(py));
+                if (x0 < -1 || x0 >= intensity.width || y0 < -1 || y0 >= intensity.height) continue;
+                double fx = px - x0;
+                double fy = py - y0;
+                float w = static_cast<float>(weight * density_[i] / REST_DENSITY);
+                const float corners[4] = {static_cast<float>((1 - fx) * (1 - fy)), static_cast<float>(fx * (1 - fy)),
+                                          static_cast<float>((1 - fx) * fy), static_cast<float>(fx * fy)};
+                for (int c = 0; c < 4; ++c) {
+                    int cx = x0 + (c & 1);
+                    int cy = y0 + (c >> 1);
+                    if (cx >= 0 && cx < intensity.width && cy >= 0 && cy < intensity.height) {
+                        intensity.at(cx, cy) += w * corners[c];
+                    }
+                }
+            }
+        }
+    };
+    
+    struct GalaxyParams {
+        uint32_t seed = 42;
+        int num_arms = 2;
+        int particles_per_arm = 150;
+        int core_particles = 60;
+        int star_layers = Starfield::MAX_LAYERS;
+        // SPH gas particles; simulated whole by shard 0 only.
+        int gas_particles = 0;
+        // Particle i is kept only when i % shard_count == shard_index; every
+        // shard still draws the full random sequence so shards agree on it.
+        // A shard_index of shard_count keeps no particles at all.
+        uint32_t shard_index = 0;
+        uint32_t shard_count = 1;
+    };
+    
+    constexpr int MAX_ZOOM = 3;
+    
+    // Space-filling curve used to lay particles out in memory.
+    enum class CurveOrder { None, Morton, Hilbert };
+    
+    constexpr const char* CURVE_ORDER_NAMES[] = {"off", "morton", "hilbert"};
+    
+    // Interleaves two 16-bit coordinates, x in the even bits.
+    uint32_t morton_key(uint32_t x, uint32_t y) {
+        auto spread = [](uint32_t v) {
+            v &= 0xFFFF;
+            v = (v | v << 8) & 0x00FF00FF;
+            v = (v | v << 4) & 0x0F0F0F0F;
+            v = (v | v << 2) & 0x33333333;
+            v = (v | v << 1) & 0x55555555;
+            return v;
+        };
+        return spread(x) | spread(y) << 1;
+    }
+    
+    // Distance along a 2^16 x 2^16 Hilbert curve. Unlike Morton order it
+    // never jumps across the plane, so consecutive keys are always adjacent.
+    uint32_t hilbert_key(uint32_t x, uint32_t y) {
+        constexpr uint32_t N = 1u << 16;
+        uint32_t d = 0;
+        for (uint32_t s = N / 2; s > 0; s /= 2) {
+            uint32_t rx = (x & s) ? 1 : 0;
+            uint32_t ry = (y & s) ? 1 : 0;
+            d += s * s * ((3 * rx) ^ ry);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = N - 1 - x;
+                    y = N - 1 - y;
+                }
+                swap(x, y);
+            }
+        }
+        return d;
+    }
+    
+    // How parallel accumulation resolves particles landing in the same cell.
+    enum class AccumulateMode { Auto, PrivatePlanes, Atomic, SortReduce };
+    
+    constexpr const char* ACCUMULATE_MODE_NAMES[] = {"auto", "private", "atomic", "sort"};
+    
+    // Auto's choice for one plane size and stride. Which strategy wins
+    // depends on how particles, cells and tasks compare and on the machine,
+    // so the first frames at each size run every strategy in turn and the
+    // fastest is kept from then on. Each strategy's best frame counts, so
+    // its first-use allocations do not.
+    struct AccumulateTrial {
+        static constexpr int FRAMES_PER_MODE = 3;
+        static constexpr int MODES = 3;
+        
+        int width;
+        int height;
+        size_t stride;
+        int frames = 0;
+        double best_ms[MODES] = {numeric_limits<double>::max(), numeric_limits<double>::max(),
+                                 numeric_limits<double>::max()};
+        AccumulateMode choice = AccumulateMode::Auto;  // until every strategy has run
+        
+        AccumulateMode next() const {
+            if (choice != AccumulateMode::Auto) return choice;
+            return static_cast<AccumulateMode>(1 + frames / FRAMES_PER_MODE);
+        }
+        
+        void record(AccumulateMode mode, double ms) {
+            double& best = best_ms[static_cast<int>(mode) - 1];
+            best = min(best, ms);
+            if (++frames == MODES * FRAMES_PER_MODE) {
+                choice = static_cast<AccumulateMode>(1 + (min_element(best_ms, best_ms + MODES) - best_ms));
+            }
+        }
+    };
+    
+    // Particle-to-cell assignment carried from frame to frame. Particles
+    // drift slowly across the screen, so most keep their cell between steps
+    // and only the ones that crossed a border are moved in the plane. Each
+    // particle also keeps the angle it was projected at and how far it can
+    // turn from there before its cell may change; until it gets that far it
+    // is not projected again.
+    struct CoherentBins {
+        // Full rebuilds flush the rounding left by repeated add/subtract.
+        static constexpr int REBUILD_INTERVAL = 64;
+        // The carried plane is added whole every frame, so on planes with
+        // more cells than this per particle the plain pass is cheaper: at
+        // 1000x300, 10k particles cost 40 ns each here against 26 plain,
+        // while 100k cost 22 against 31.
+        static constexpr size_t MAX_CELLS_PER_PARTICLE = 4;
+        
+        IntensityPlane plane{0, 0};
+        vector<int32_t> cells;  // -1 when off the plane
+        vector<double> anchors;
+        vector<float> margins;  // 0 forces a projection
+        Vec2 camera;
+        int frames_until_rebuild = 0;
+    };
+    
+    class Galaxy {
+    private:
+        mt19937 rng_;
+        uint32_t shard_index_;
+        uint32_t shard_count_;
+        size_t generated_particles_ = 0;
+        ParticleStore particles_;
+#ifndef _WIN32
+        shared_ptr<const MappedCatalog> catalog_;
+#endif
+        ThreadPool* pool_ = nullptr;
+        unique_ptr<SnapshotPublisher> snapshots_;
+        uint64_t steps_ = 0;
+        mutable vector<IntensityPlane> partial_planes_;
+        AccumulateMode accumulate_mode_ = AccumulateMode::Auto;
+        mutable vector<AccumulateTrial> accumulate_trials_;
+        mutable vector<uint32_t> sort_keys_;
+        mutable vector<float> sort_values_;
+        mutable RadixSort<float> cell_sort_;
+        unique_ptr<GasLayer> gas_;
+        CurveOrder reorder_ = CurveOrder::None;
+        int reorder_interval_ = 64;
+        vector<uint32_t> curve_keys_;
+        RadixSort<double, double, double, double> particle_sort_;
+        mutable CoherentBins bins_;
+        Starfield starfield_;
+        mutable StarBatch stars_;
+        mutable Vec2 stars_camera_;
+        mutable bool stars_valid_ = false;
+        Vec2 origin_;
+        Vec2 camera_;
+        Vec2 center_;
+        int width_, height_;
+        double time_;
+        double aspect_ratio_;
+        double scale_ = 1.0;
+        bool simd_ = true;
+        mutable uint64_t last_frame_hash_ = 0;
+        mutable IntensityPyramid pyramid_;
+        int zoom_ = 0;
+        mutable string status_;
+        OutputSink* sink_ = nullptr;
+        
+    public:
+        Galaxy(int w, int h, const GalaxyParams& params = {})
+            : rng_(params.seed), shard_index_(params.shard_index), shard_count_(max(params.shard_count, 1u)),
+              starfield_(params.seed, params.star_layers), width_(w), height_(h), time_(0) {
+            origin_ = {w / 2.0, h / 2.0};
+            center_ = origin_;
+            aspect_ratio_ = 2.0;
+            
+            init_spiral_arms(params.num_arms, params.particles_per_arm);
+            init_core(params.core_particles);
+            if (params.gas_particles > 0 && shard_index_ == 0) {
+                gas_ = make_unique<GasLayer>(params.gas_particles, params.seed ^ 0x9e3779b9u);
+            }
+        }
+        
+        void update(double dt) {
+            update_stars(dt);
+            step_gas(dt);
+        }
+        
+        // The two halves of update(), timed separately by --bench.
+        void update_stars(double dt) {
+            time_ += dt;
+            ++steps_;
+            
+            ThreadPool::parallel_ranges(pool_, particles_.size(), ThreadPool::GRAIN,
+                                        [&](size_t, size_t begin, size_t end) { update_particles(dt, begin, end); });
+            
+            // Differential rotation slowly scatters neighbours apart, so
+            // the layout is refreshed every few steps rather than kept exact.
+            // Snapshot readers rely on stable indices and keep the order.
+            if (reorder_ != CurveOrder::None && !snapshots_ && steps_ % reorder_interval_ == 0) {
+                reorder_particles(reorder_);
+            }
+            
+            if (snapshots_) snapshots_->publish(steps_, time_, particles_.angle);
+        }
+        
+        void step_gas(double dt) {
+            if (gas_) gas_->step(dt, pool_);
+        }
+        
+        size_t gas_particles() const { return gas_ ? gas_->size() : 0; }
+        
+        // Keeps particle storage sorted along a space-filling curve of the
+        // current positions, refreshed every `interval` steps.
+        void set_reorder(CurveOrder order, int interval = 64) {
+            reorder_ = order;
+            reorder_interval_ = max(interval, 1);
+            if (order != CurveOrder::None) reorder_particles(order);
+        }
+        
+        // Sorts particle storage along the curve so particles that land in
+        // nearby cells also sit near each other in memory.
+        void reorder_particles(CurveOrder order) {
+            const size_t count = particles_.size();
+            if (order == CurveOrder::None || count == 0) return;
+            
+            double extent = *max_element(particles_.radius.begin(), particles_.radius.end());
+            double scale = 65535.0 / (2.0 * max(extent, 1e-9));
+            curve_keys_.resize(count);
+            auto key_range = [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    double r = particles_.radius[i] * scale;
+                    auto x = static_cast<uint32_t>(clamp(32767.5 + r * cos(particles_.angle[i]), 0.0, 65535.0));
+                    auto y = static_cast<uint32_t>(clamp(32767.5 + r * sin(particles_.angle[i]), 0.0, 65535.0));
+                    curve_keys_[i] = order == CurveOrder::Morton ? morton_key(x, y) : hilbert_key(x, y);
+                }
+            };
+            ThreadPool::parallel_ranges(pool_, count, ThreadPool::GRAIN,
+                                        [&](size_t, size_t begin, size_t end) { key_range(begin, end); });
+            particle_sort_.sort(pool_, 32, curve_keys_, particles_.radius, particles_.angle,
+                                particles_.angular_velocity, particles_.brightness);
+            bins_.frames_until_rebuild = 0;
+        }
+        
+        // Starts publishing the particle angles after every step; call once
+        // the particle set is final.
+        SnapshotPublisher& enable_snapshots() {
+            snapshots_ = make_unique<SnapshotPublisher>(particles_.size());
+            snapshots_->publish(steps_, time_, particles_.angle);
+            return *snapshots_;
+        }
+        
+        // Spreads update and accumulation over the pool; null runs serially.
+        void set_thread_pool(ThreadPool* pool) {
+            pool_ = pool;
+            accumulate_trials_.clear();
+        }
+        
+        const Vec2& camera() const { return camera_; }
+        
+        void set_camera(const Vec2& camera) {
+            camera_ = camera;
+            center_ = origin_ - camera_ * (1.0 / (1 << zoom_));
+        }
+        
+        int zoom() const { return zoom_; }
+        
+        // Zoom level k shows 2^k x 2^k world cells per screen cell.
+        void set_zoom(int zoom) {
+            zoom_ = clamp(zoom, 0, MAX_ZOOM);
+            set_camera(camera_);
+        }
+        
+        RenderStats render(double real_elapsed_sec = 0, int quality_level = 0) const {
+            RenderStats stats;
+            
+            auto stage_start = chrono::steady_clock::now();
+            const IntensityPlane& intensity = accumulate_zoomed(pyramid_, zoom_, quality_level);
+            stats.accumulate_ms = elapsed_ms(stage_start);
+            stats.accumulated = chrono::steady_clock::now();
+            
+            present(intensity, real_elapsed_sec, quality_level, stats);
+            return stats;
+        }
+        
+        // Accumulates the world area seen at the given zoom at full
+        // resolution and returns the pyramid level matching the screen.
+        const IntensityPlane& accumulate_zoomed(IntensityPyramid& pyramid, int zoom, int quality_level) const {
+            IntensityPlane& base = pyramid.reset(width_ << zoom, height_ << zoom);
+            accumulate(base, quality_level);
+            pyramid.build(zoom + 1);
+            return pyramid.level(zoom);
+        }
+        
+        // Shades an already accumulated particle plane and writes the frame.
+        void present(const IntensityPlane& intensity, double real_elapsed_sec, int quality_level,
+                     RenderStats& stats) const {
+            vector<string> screen = shade(intensity, quality_level, stats);
+            stats.shaded = chrono::steady_clock::now();
+            
+            auto stage_start = chrono::steady_clock::now();
+            stats.output_skipped = !output(screen, real_elapsed_sec, quality_level);
+            stats.output_ms = elapsed_ms(stage_start);
+            stats.written = chrono::steady_clock::now();
+        }
+        
+        double time() const { return time_; }
+        
+        // Cells per world unit and cell width relative to height for the
+        // particle planes. Terminal cells are twice as tall as wide; canvas
+        // pixels are square and much smaller.
+        void set_projection(double scale, double aspect_ratio) {
+            scale_ = scale;
+            aspect_ratio_ = aspect_ratio;
+            bins_.frames_until_rebuild = 0;
+        }
+        
+        // Switches between the SIMD128 and scalar particle kernels in wasm
+        // builds; other builds always run the scalar loops.
+        void set_simd(bool enabled) { simd_ = enabled; }
+        
+        // Strategy for multi-task accumulation; Auto times the others on
+        // the first frames at each plane size and keeps the fastest.
+        void set_accumulate_mode(AccumulateMode mode) { accumulate_mode_ = mode; }
+        
+        // What Auto settled on for full-detail frames the size of
+        // intensity; Auto while it is still timing them.
+        AccumulateMode accumulate_mode_for(const IntensityPlane& intensity) const {
+            return accumulate_trial(intensity, 1).choice;
+        }
+        
+        // Where output() sends frames; without a sink they are dropped.
+        void set_output(OutputSink* sink) { sink_ = sink; }
+        
+        // Extra text appended to the status line.
+        void set_status(string status) const { status_ = move(status); }
+        
+        const ParticleStore& particles() const { return particles_; }
+        
+        void add_particles(const ParticleStore& particles) {
+            particles_.append(particles);
+            accumulate_trials_.clear();
+        }
+        
+        void add_particles(ParticleStore&& particles) {
+            if (particles_.size() == 0) particles_ = move(particles);
+            else particles_.append(particles);
+            accumulate_trials_.clear();
+        }
+        
+#ifndef _WIN32
+        void attach_catalog(shared_ptr<const MappedCatalog> catalog) { catalog_ = move(catalog); }
+#endif
+        
+        void accumulate(IntensityPlane& intensity, int quality_level) const {
+            accumulate_stars(intensity, quality_level);
+            accumulate_gas(intensity);
+        }
+        
+        void accumulate_stars(IntensityPlane& intensity, int quality_level) const {
+            accumulate_particles(intensity, QUALITY_LEVELS[quality_level]);
+        }
+        
+        void accumulate_gas(IntensityPlane& intensity) const {
+            if (gas_) gas_->accumulate(intensity, plane_center(intensity), aspect_ratio_ * scale_, scale_);
+        }
+        
+        // Builds the character plane without touching the terminal.
+        vector<string> compose(int quality_level = 0) const {
+            RenderStats stats;
+            IntensityPlane intensity(width_, height_);
+            accumulate(intensity, quality_level);
+            return shade(intensity, quality_level, stats);
+        }
+        
+        // Shades pyramid level k of the current view on its own, without
+        // stars or the core overlay, as a (width >> k) x (height >> k) frame.
+        vector<string> thumbnail(int level) const {
+            IntensityPyramid pyramid;
+            accumulate(pyramid.reset(width_, height_), 0);
+            pyramid.build(level + 1);
+            const IntensityPlane& plane = pyramid.level(pyramid.levels() - 1);
+            vector<string> screen(plane.height, string(plane.width, ' '));
+            apply_intensity(screen, plane);
+            return screen;
+        }
+        
+        // Draws stars, the shaded particle plane and the core overlay.
+        vector<string> shade(const IntensityPlane& intensity, int quality_level, RenderStats& stats) const {
+            vector<string> screen(height_, string(width_, ' '));
+            
+            auto stage_start = chrono::steady_clock::now();
+            render_stars(screen, QUALITY_LEVELS[quality_level]);
+            stats.stars_ms = elapsed_ms(stage_start);
+            
+            stage_start = chrono::steady_clock::now();
+            apply_intensity(screen, intensity);
+            render_core(screen);
+            stats.shade_ms = elapsed_ms(stage_start);
+            
+            return screen;
+        }
+        
+    private:
+        double random_double(double min_val, double max_val) {
+            uniform_real_distribution<double> dist(min_val, max_val);
+            return dist(rng_);
+        }
+        
+        void add_particle(double radius, double angle, double angular_velocity, double brightness) {
+            if (generated_particles_++ % shard_count_ == shard_index_) {
+                particles_.push_back(radius, angle, angular_velocity, brightness);
+            }
+        }
+        
+        void init_spiral_arms(int num_arms, int particles_per_arm) {
+            for (int arm = 0; arm < num_arms; ++arm) {
+                double arm_offset = arm * TWO_PI / num_arms;
+                
+                for (int i = 0; i < particles_per_arm; ++i) {
+                    double t = i / static_cast<double>(particles_per_arm);
+                    double base_radius = 2.0 + t * 14.0;
+                    double spiral_angle = arm_offset + t * 2.5 * PI;
+                    
+                    double radius_variation = random_double(-1.0, 1.0) * (0.5 + t * 1.5);
+                    double angle_variation = random_double(-0.2, 0.2);
+                    
+                    double radius = base_radius + radius_variation;
+                    double angle = spiral_angle + angle_variation;
+                    
+                    double angular_velocity = 0.15 / sqrt(radius);
+                    double brightness = 0.3 + 0.7 * (1.0 - t * 0.6);
+                    
+                    add_particle(radius, angle, angular_velocity, brightness);
+                }
+            }
+        }
+        
+        void init_core(int core_particles) {
+            for (int i = 0; i < core_particles; ++i) {
+                double radius = random_double(0.5, 3.0);
+                double angle = random_double(0, TWO_PI);
+                double angular_velocity = 0.3 / sqrt(radius + 0.5);
+                double brightness = 0.8 + random_double(0, 0.2);
+                
+                add_particle(radius, angle, angular_velocity, brightness);
+            }
+        }
+        
+        void render_stars(vector<string>& screen, const QualitySettings& quality) const {
+            // Star positions depend only on the camera, so the batch is
+            // regenerated when it moves and just re-evaluated otherwise.
+            if (!stars_valid_ || stars_camera_.x != camera_.x || stars_camera_.y != camera_.y) {
+                stars_.clear();
+                starfield_.collect(camera_, width_, height_, stars_);
+                stars_camera_ = camera_;
+                stars_valid_ = true;
+            }
+            stars_.evaluate(time_, quality.twinkle);
+            
+            for (size_t i = 0; i < stars_.size(); ++i) {
+                int sx = static_cast<int>(floor(stars_.x[i]));
+                int sy = static_cast<int>(floor(stars_.y[i]));
+                
+                if (sx >= 0 && sx < width_ && sy >= 0 && sy < height_) {
+                    float b = stars_.brightness[i];
+                    if (b > 0.7f) screen[sy][sx] = '*';
+                    else if (b > 0.4f) screen[sy][sx] = '+';
+                    else if (b > 0.2f) screen[sy][sx] = '.';
+                }
+            }
+        }
+        
+        // Splits the particles evenly, aligning each start to the stride so
+        // subsampling picks the same particles as a serial pass.
+        pair<size_t, size_t> task_range(size_t task, size_t tasks, size_t stride) const {
+            return ThreadPool::range(task, tasks, particles_.size(), stride);
+        }
+        
+        void accumulate_particles(IntensityPlane& intensity, const QualitySettings& quality) const {
+            const size_t stride = quality.particle_stride;
+            size_t tasks = ThreadPool::tasks_for(pool_, particles_.size() / stride);
+            
+            if (tasks <= 1 && stride == 1 &&
+                intensity.cells.size() <= particles_.size() * CoherentBins::MAX_CELLS_PER_PARTICLE) {
+                accumulate_coherent(intensity);
+            } else if (tasks <= 1) {
+                accumulate_columns(intensity, particles_.radius.data(), particles_.angle.data(),
+                                   particles_.angular_velocity.data(), particles_.brightness.data(),
+                                   0, particles_.size(), stride, 0.0);
+            } else {
+                AccumulateTrial* trial = nullptr;
+                AccumulateMode mode = accumulate_mode_;
+                if (mode == AccumulateMode::Auto) {
+                    trial = &accumulate_trial(intensity, stride);
+                    mode = trial->next();
+                    if (trial->choice != AccumulateMode::Auto) trial = nullptr;
+                }
+                
+                auto start = chrono::steady_clock::now();
+                if (mode == AccumulateMode::Atomic) accumulate_atomic(intensity, stride, tasks);
+                else if (mode == AccumulateMode::SortReduce) accumulate_sorted(intensity, stride, tasks);
+                else accumulate_private(intensity, stride, tasks);
+                if (trial) trial->record(mode, elapsed_ms(start));
+            }
+#ifndef _WIN32
+            if (catalog_) accumulate_catalog(intensity, stride);
+#endif
+        }
+        
+        AccumulateTrial& accumulate_trial(const IntensityPlane& intensity, size_t stride) const {
+            for (AccumulateTrial& trial : accumulate_trials_) {
+                if (trial.width == intensity.width && trial.height == intensity.height && trial.stride == stride) {
+                    return trial;
+                }
+            }
+            return accumulate_trials_.emplace_back(AccumulateTrial{intensity.width, intensity.height, stride});
+        }
+        
+        // Each task scatters into its own plane; the planes are then summed
+        // row band by row band, also in parallel.
+        void accumulate_private(IntensityPlane& intensity, size_t stride, size_t tasks) const {
+            if (partial_planes_.size() < tasks || partial_planes_[0].width != intensity.width ||
+                partial_planes_[0].height != intensity.height) {
+                partial_planes_.assign(tasks, IntensityPlane(intensity.width, intensity.height));
+            }
+            pool_->parallel_for(tasks, [&](size_t t) {
+                IntensityPlane& plane = partial_planes_[t];
+                fill(plane.cells.begin(), plane.cells.end(), 0.0f);
+                auto [begin, end] = task_range(t, tasks, stride);
+                accumulate_columns(plane, particles_.radius.data(), particles_.angle.data(),
+                                   particles_.angular_velocity.data(), particles_.brightness.data(),
+                                   begin, end, stride, 0.0);
+            });
+            pool_->parallel_for(tasks, [&](size_t t) {
+                auto [begin, end] = ThreadPool::range(t, tasks, intensity.cells.size());
+                for (size_t p = 0; p < tasks; ++p) {
+                    const float* src = partial_planes_[p].cells.data();
+                    for (size_t i = begin; i < end; ++i) intensity.cells[i] += src[i];
+                }
+            });
+        }
+        
+        // Scatters straight into the shared plane; cheap while particles
+        // rarely share a cell, contended once they pile up.
+        void accumulate_atomic(IntensityPlane& intensity, size_t stride, size_t tasks) const {
+            const Vec2 center = plane_center(intensity);
+            pool_->parallel_for(tasks, [&](size_t t) {
+                auto [begin, end] = task_range(t, tasks, stride);
+                for (size_t i = begin; i < end; i += stride) {
+                    int32_t cell = cell_index(intensity, center, particles_.radius[i], particles_.angle[i]);
+                    if (cell < 0) continue;
+                    atomic_ref<float>(intensity.cells[cell])
+                        .fetch_add(static_cast<float>(particles_.brightness[i] * stride), memory_order_relaxed);
+                }
+            });
+        }
+        
+        // Keys each sampled particle by cell, radix-sorts the keys with their
+        // brightness, then sums runs of equal keys. Every cell is written by
+        // exactly one task, so nothing conflicts and no plane is replicated.
+        void accumulate_sorted(IntensityPlane& intensity, size_t stride, size_t tasks) const {
+            const size_t count = (particles_.size() + stride - 1) / stride;
+            // Off-plane particles get one past the last cell and sort last.
+            const uint32_t outside = static_cast<uint32_t>(intensity.cells.size());
+            sort_keys_.resize(count);
+            sort_values_.resize(count);
+            
+            const Vec2 center = plane_center(intensity);
+            pool_->parallel_for(tasks, [&](size_t t) {
+                auto [begin, end] = task_range(t, tasks, stride);
+                for (size_t i = begin; i < end; i += stride) {
+                    int32_t cell = cell_index(intensity, center, particles_.radius[i], particles_.angle[i]);
+                    sort_keys_[i / stride] = cell < 0 ? outside : static_cast<uint32_t>(cell);
+                    sort_values_[i / stride] = static_cast<float>(particles_.brightness[i] * stride);
+                }
+            });
+            cell_sort_.sort(pool_, bit_width(outside), sort_keys_, sort_values_);
+            
+            const vector<uint32_t>& keys = sort_keys_;
+            const vector<float>& values = sort_values_;
+            pool_->parallel_for(tasks, [&](size_t t) {
+                // A run crossing a task boundary belongs to the task it starts in.
+                auto [begin, end] = ThreadPool::range(t, tasks, count);
+                while (end > 0 && end < count && keys[end] == keys[end - 1]) ++end;
+                while (begin > 0 && begin < end && keys[begin] == keys[begin - 1]) ++begin;
+                
+                for (size_t i = begin; i < end && keys[i] < outside;) {
+                    uint32_t key = keys[i];
+                    float sum = 0.0f;
+                    for (; i < end && keys[i] == key; ++i) sum += values[i];
+                    intensity.cells[key] += sum;
+                }
+            });
+        }
+        
+        // Serial full-detail path: keeps last frame's binning and only
+        // projects particles that may have left their cell, so its cost
+        // follows motion rather than particle count, plus one pass over the
+        // plane. Subsampled, parallel and sparse frames take the plain paths
+        // instead.
+        void accumulate_coherent(IntensityPlane& intensity) const {
+            const size_t count = particles_.size();
+            if (bins_.frames_until_rebuild-- <= 0 || bins_.cells.size() != count ||
+                bins_.plane.width != intensity.width || bins_.plane.height != intensity.height ||
+                bins_.camera.x != camera_.x || bins_.camera.y != camera_.y) {
+                bins_.plane = IntensityPlane(intensity.width, intensity.height);
+                bins_.cells.assign(count, -1);
+                bins_.anchors.assign(count, 0.0);
+                bins_.margins.assign(count, 0.0f);
+                bins_.camera = camera_;
+                bins_.frames_until_rebuild = CoherentBins::REBUILD_INTERVAL;
+            }
+            
+            const Vec2 center = plane_center(intensity);
+            const double* angle = particles_.angle.data();
+            uint32_t moved[PROJECT_BLOCK];
+            double radii[PROJECT_BLOCK], angles[PROJECT_BLOCK];
+            int32_t cells[PROJECT_BLOCK];
+            float margins[PROJECT_BLOCK];
+            for (size_t block = 0; block < count; block += PROJECT_BLOCK) {
+                size_t end = min(block + PROJECT_BLOCK, count);
+                size_t n = 0;
+                for (size_t i = block; i < end; ++i) {
+                    moved[n] = static_cast<uint32_t>(i - block);
+                    n += !(fabs(angle[i] - bins_.anchors[i]) < bins_.margins[i]);
+                }
+                if (n == 0) continue;
+                
+                for (size_t j = 0; j < n; ++j) {
+                    radii[j] = particles_.radius[block + moved[j]];
+                    angles[j] = angle[block + moved[j]];
+                }
+                project_cells(intensity, center, radii, angles, n, cells, margins);
+                for (size_t j = 0; j < n; ++j) {
+                    size_t i = block + moved[j];
+                    bins_.anchors[i] = angles[j];
+                    bins_.margins[i] = margins[j];
+                    int32_t cell = cells[j];
+                    int32_t previous = bins_.cells[i];
+                    if (cell == previous) continue;
+                    
+                    float weight = static_cast<float>(particles_.brightness[i]);
+                    if (previous >= 0) bins_.plane.cells[previous] -= weight;
+                    if (cell >= 0) bins_.plane.cells[cell] += weight;
+                    bins_.cells[i] = cell;
+                }
+            }
+            intensity.add(bins_.plane);
+        }
+        
+        static constexpr size_t PROJECT_BLOCK = 256;
+        
+        // Cell indices and cell margins of count particles into cells and
+        // margins.
+        void project_cells(const IntensityPlane& intensity, const Vec2& center, const double* radius,
+                           const double* angle, size_t count, int32_t* cells, float* margins) const {
+            const double scale_x = aspect_ratio_ * scale_;
+#ifdef __wasm_simd128__
+            if (simd_) {
+                project_cells_simd128(radius, angle, count, center.x, center.y, scale_x, scale_, intensity.width,
+                                      intensity.height, cells, margins);
+                return;
+            }
+#endif
+            for (size_t i = 0; i < count; ++i) {
+                double x = center.x + radius[i] * cos(angle[i]) * aspect_ratio_ * scale_;
+                double y = center.y + radius[i] * sin(angle[i]) * scale_;
+                int px = static_cast<int>(x);
+                int py = static_cast<int>(y);
+                bool inside = px >= 0 && px < intensity.width && py >= 0 && py < intensity.height;
+                cells[i] = inside ? py * intensity.width + px : -1;
+                margins[i] = cell_margin(x, y, fabs(radius[i] * scale_x), fabs(radius[i] * scale_), inside,
+                                         intensity.width, intensity.height);
+            }
+        }
+        
+        // How far a particle at plane position (x, y) can turn before its
+        // cell may change. Turning by t moves it at most reach * t along
+        // each axis, so it stays put until it covers the distance to the
+        // nearest cell border, or, off the plane, the distance back onto it.
+        // Negative when too close to call.
+        static float cell_margin(double x, double y, double reach_x, double reach_y, bool inside, int width,
+                                 int height) {
+            constexpr double SLACK = 1.0 / 1024;
+            if (inside) {
+                double fx = x - floor(x);
+                double fy = y - floor(y);
+                return static_cast<float>(
+                    min((min(fx, 1.0 - fx) - SLACK) / reach_x, (min(fy, 1.0 - fy) - SLACK) / reach_y));
+            }
+            // Truncation puts (-1, 0) in the first column and row.
+            double dx = max({0.0, -1.0 - x, x - width});
+            double dy = max({0.0, -1.0 - y, y - height});
+            return static_cast<float>(max((dx - SLACK) / reach_x, (dy - SLACK) / reach_y));
+        }
+        
+        void update_particles(double dt, size_t begin, size_t end) {
+#ifdef __wasm_simd128__
+            if (simd_) {
+                update_angles_simd128(particles_.angle.data() + begin, particles_.angular_velocity.data() + begin,
+                                      end - begin, dt);
+                return;
+            }
+#endif
+            particles_.update(dt, begin, end);
+        }
+        
+        // The galaxy sits at the middle of whatever plane it is drawn into,
+        // offset by the camera, so larger planes simply see more of the sky.
+        Vec2 plane_center(const IntensityPlane& intensity) const {
+            return Vec2{intensity.width / 2.0, intensity.height / 2.0} - camera_;
+        }
+        
+        // Flat index of the cell a particle lands in, or -1 off the plane.
+        int32_t cell_index(const IntensityPlane& intensity, const Vec2& center, double radius, double angle) const {
+            int px = static_cast<int>(center.x + radius * cos(angle) * aspect_ratio_ * scale_);
+            int py = static_cast<int>(center.y + radius * sin(angle) * scale_);
+            if (px < 0 || px >= intensity.width || py < 0 || py >= intensity.height) return -1;
+            return py * intensity.width + px;
+        }
+        
+        template <typename T>
+        void accumulate_columns(IntensityPlane& intensity, const T* radius, const T* angle,
+                                const T* angular_velocity, const T* brightness,
+                                size_t begin, size_t end, size_t stride, double time) const {
+            const Vec2 center = plane_center(intensity);
+            
+            // Subsampled particles carry the weight of the ones skipped.
+            for (size_t i = begin; i < end; i += stride) {
+                int32_t cell = cell_index(intensity, center, radius[i], angle[i] + angular_velocity[i] * time);
+                if (cell >= 0) intensity.cells[cell] += static_cast<float>(brightness[i] * stride);
+            }
+        }
+        
+#ifndef _WIN32
+        // Catalog angles are never written back: a mapped particle sits at
+        // angle + angular_velocity * time, so one read-only pass per frame
+        // covers both the step and the rasterization.
+        void accumulate_catalog(IntensityPlane& intensity, size_t stride) const {
+            const MappedCatalog& c = *catalog_;
+            for (size_t begin = 0; begin < c.count; begin += MappedCatalog::CHUNK) {
+                size_t end = min(begin + MappedCatalog::CHUNK, c.count);
+                c.prefetch(end, end + MappedCatalog::CHUNK);
+                // Keep the stride phase continuous across chunk borders.
+                size_t first = begin + (stride - begin % stride) % stride;
+                accumulate_columns(intensity, c.radius, c.angle, c.angular_velocity, c.brightness,
+                                   first, end, stride, time_);
+                c.release(begin, end);
+            }
+        }
+#endif
+        
+        void apply_intensity(vector<string>& screen, const IntensityPlane& intensity) const {
+            for (int y = 0; y < intensity.height; ++y) {
+                for (int x = 0; x < intensity.width; ++x) {
+                    float value = intensity.at(x, y);
+                    if (value > 0.1f) {
+                        int idx = static_cast<int>(value * 3.0f);
+                        idx = clamp(idx, 0, static_cast<int>(GRADIENT.length()) - 1);
+                        screen[y][x] = GRADIENT[idx];
+                    }
+                }
+            }
+        }
+        
+        void render_core(vector<string>& screen) const {
+            int cx = static_cast<int>(center_.x);
+            int cy = static_cast<int>(center_.y);
+            
+            if (cx > 0 && cx < width_ - 1 && cy >= 0 && cy < height_) {
+                screen[cy][cx] = '@';
+                screen[cy][cx - 1] = '(';
+                screen[cy][cx + 1] = ')';
+            }
+        }
+        
+        // Returns false when the frame matched the previous one and nothing was written.
+        bool output(const vector<string>& screen, double real_elapsed_sec, int quality_level) const {
+            ostringstream buffer;
+            
+            for (const auto& line : screen) {
+                buffer << line << '\n';
+            }
+            
+            buffer << "\n Time: " << static_cast<int>(real_elapsed_sec) << "s"
+                   << "  Quality: " << (MAX_QUALITY_LEVEL - quality_level) << "/" << MAX_QUALITY_LEVEL
+                   << status_;
+            string frame = buffer.str();
+            
+            uint64_t hash = hash_bytes(frame);
+            if (hash == last_frame_hash_) return false;
+            last_frame_hash_ = hash;
+            
+            if (!sink_) return false;
+            sink_->write(move(frame));
+            return true;
+        }
+    };
+    
+#ifndef _WIN32
+    bool read_full(int fd, void* data, size_t size) {
+        char* p = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t n = read(fd, p, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+    
+    bool write_full(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = write(fd, p, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+    
+    struct ShardCommand {
+        double advance;     // simulation time to step before accumulating
+        double camera_x;
+        double camera_y;
+        int32_t quality_level;
+        int32_t zoom;
+    };
+    
+    // Splits the particles across forked worker processes, each owning only
+    // its shard. Per frame every worker steps its shard, accumulates it into
+    // a private plane and sends the plane back over a socketpair; the
+    // coordinator sums the planes.
+    class ShardCoordinator {
+    private:
+        struct Worker {
+            pid_t pid;
+            int fd;
+        };
+        
+        vector<Worker> workers_;
+        IntensityPlane partial_;
+        
+        static void run_worker(int fd, int width, int height, const GalaxyParams& params) {
+            Galaxy galaxy(width, height, params);
+            IntensityPyramid pyramid;
+            ShardCommand command;
+            
+            // Zoomed-out frames are reduced to screen size before they go on
+            // the wire.
+            while (read_full(fd, &command, sizeof(command))) {
+                galaxy.update(command.advance);
+                galaxy.set_camera({command.camera_x, command.camera_y});
+                const IntensityPlane& plane = galaxy.accumulate_zoomed(pyramid, command.zoom, command.quality_level);
+                if (!write_full(fd, plane.cells.data(), plane.cells.size() * sizeof(float))) break;
+            }
+        }
+        
+    public:
+        ShardCoordinator(int width, int height, GalaxyParams params, int count)
+            : partial_(width, height) {
+            params.star_layers = 0;
+            params.shard_count = count;
+            
+            for (int i = 0; i < count; ++i) {
+                int fds[2];
+                if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) break;
+                
+                params.shard_index = i;
+                pid_t pid = fork();
+                if (pid == 0) {
+                    // Ctrl+C reaches the whole process group; workers leave
+                    // when the coordinator closes its end instead.
+                    signal(SIGINT, SIG_IGN);
+                    close(fds[0]);
+                    for (const auto& w : workers_) close(w.fd);
+                    run_worker(fds[1], width, height, params);
+                    _exit(0);
+                }
+                
+                close(fds[1]);
+                if (pid < 0) {
+                    close(fds[0]);
+                    break;
+                }
+                workers_.push_back({pid, fds[0]});
+            }
+        }
+        
+        ~ShardCoordinator() {
+            for (const auto& w : workers_) close(w.fd);
+            for (const auto& w : workers_) waitpid(w.pid, nullptr, 0);
+        }
+        
+        ShardCoordinator(const ShardCoordinator&) = delete;
+        ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+        
+        size_t size() const { return workers_.size(); }
+        
+        // Broadcasts the step to all workers first so they run concurrently,
+        // then reduces their planes in worker order.
+        bool gather(double advance, const Vec2& camera, int quality_level, int zoom, IntensityPlane& intensity) {
+            ShardCommand command{advance, camera.x, camera.y, quality_level, zoom};
+            for (const auto& w : workers_) {
+                if (!write_full(w.fd, &command, sizeof(command))) return false;
+            }
+            
+            for (const auto& w : workers_) {
+                if (!read_full(w.fd, partial_.cells.data(), partial_.cells.size() * sizeof(float))) return false;
+                intensity.add(partial_);
+            }
+            return true;
+        }
+    };
+#endif
+    
+    template <typename T>
+    void write_le(ostream& out, T value) {
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            out.put(static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xff));
+        }
+    }
+    
+    // Writes particles in the catalog layout read by MappedCatalog.
+    bool write_catalog(const string& path, const ParticleStore& particles) {
+        ofstream out(path, ios::binary);
+        out.write("SPCAT001", 8);
+        write_le<uint64_t>(out, particles.size());
+        
+        vector<float> column(particles.size());
+        for (const vector<double>* source : {&particles.radius, &particles.angle,
+                                             &particles.angular_velocity, &particles.brightness}) {
+            transform(source->begin(), source->end(), column.begin(),
+                      [](double v) { return static_cast<float>(v); });
+            out.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(float));
+        }
+        return static_cast<bool>(out);
+    }
+    
+    template <typename T>
+    bool read_le(istream& in, T& value) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            int c = in.get();
+            if (c == EOF) return false;
+            v |= static_cast<uint64_t>(static_cast<unsigned char>(c)) << (8 * i);
+        }
+        value = static_cast<T>(v);
+        return true;
+    }
+    
+    // Compressed particle snapshots, one column per ParticleStore field:
+    //   "SPSNAP01", u64 count, then per column
+    //   u8 column, u8 encoding, f32 scale, u64 payload bytes, payload
+    // Particles are written in radius order so the radius column becomes
+    // small non-negative deltas, bit-packed per block of 128 with a one-byte
+    // width prefix. Angles are 16-bit fractions of a turn; angular velocity
+    // and brightness are 16- and 8-bit fractions of the column's largest
+    // magnitude, spanning [-scale, scale] when the column has negative
+    // values. Decoding reads one block at a time straight into the store.
+    class Snapshot {
+    private:
+        enum Encoding : uint8_t {
+            DELTA_BITPACK = 1, TURN_U16 = 2, SCALED_U16 = 3, SCALED_U8 = 4, SIGNED_U16 = 5, SIGNED_U8 = 6
+        };
+        
+        static constexpr size_t BLOCK = 128;
+        static constexpr double RADIUS_SCALE = 1.0 / 4096;
+        // Angle, angular velocity and brightness bytes; radius deltas can
+        // pack to nothing.
+        static constexpr uint64_t MIN_PARTICLE_BYTES = 2 + 2 + 1;
+        
+        static void write_column(ostream& out, uint8_t column, Encoding encoding, float scale,
+                                 const string& payload) {
+            out.put(static_cast<char>(column));
+            out.put(static_cast<char>(encoding));
+            uint32_t scale_bits;
+            memcpy(&scale_bits, &scale, sizeof(scale));
+            write_le<uint32_t>(out, scale_bits);
+            write_le<uint64_t>(out, payload.size());
+            out.write(payload.data(), payload.size());
+        }
+        
+        static string encode_deltas(const vector<uint32_t>& values) {
+            string payload;
+            uint32_t previous = 0;
+            for (size_t begin = 0; begin < values.size(); begin += BLOCK) {
+                size_t end = min(begin + BLOCK, values.size());
+                uint32_t deltas[BLOCK];
+                uint32_t widest = 0;
+                for (size_t i = begin; i < end; ++i) {
+                    deltas[i - begin] = values[i] - previous;
+                    previous = values[i];
+                    widest |= deltas[i - begin];
+                }
+                
+                int width = bit_width(widest);
+                payload += static_cast<char>(width);
+                uint64_t bits = 0;
+                int filled = 0;
+                for (size_t i = 0; i < end - begin; ++i) {
+                    bits |= static_cast<uint64_t>(deltas[i]) << filled;
+                    filled += width;
+                    while (filled >= 8) {
+                        payload += static_cast<char>(bits & 0xff);
+                        bits >>= 8;
+                        filled -= 8;
+                    }
+                }
+                if (filled > 0) payload += static_cast<char>(bits & 0xff);
+            }
+            return payload;
+        }
+        
+        // Maps a value onto [0, 1] for quantisation and back.
+        static double to_unit(Encoding encoding, double value, double scale) {
+            if (scale <= 0) return 0;
+            double unit = value / scale;
+            if (encoding == TURN_U16) return unit - floor(unit);
+            if (encoding == SIGNED_U16 || encoding == SIGNED_U8) return clamp(unit, -1.0, 1.0) * 0.5 + 0.5;
+            return clamp(unit, 0.0, 1.0);
+        }
+        
+        static double from_unit(Encoding encoding, double unit, double scale) {
+            if (encoding == SIGNED_U16 || encoding == SIGNED_U8) return (unit * 2 - 1) * scale;
+            return unit * scale;
+        }
+        
+        template <typename T>
+        static string encode_scaled(const vector<double>& values, const vector<uint32_t>& order, Encoding encoding,
+                                    double scale) {
+            constexpr double top = numeric_limits<T>::max();
+            string payload;
+            payload.reserve(order.size() * sizeof(T));
+            for (uint32_t i : order) {
+                double q = round(to_unit(encoding, values[i], scale) * top);
+                T v = static_cast<T>(q);
+                for (size_t b = 0; b < sizeof(T); ++b) payload += static_cast<char>((v >> (8 * b)) & 0xff);
+            }
+            return payload;
+        }
+        
+        static bool decode_deltas(istream& in, size_t count, vector<double>& out) {
+            uint32_t previous = 0;
+            unsigned char packed[BLOCK * 4];
+            for (size_t begin = 0; begin < count; begin += BLOCK) {
+                size_t n = min(BLOCK, count - begin);
+                int width = in.get();
+                if (width < 0 || width > 32) return false;
+                size_t bytes = (n * width + 7) / 8;
+                if (!in.read(reinterpret_cast<char*>(packed), bytes)) return false;
+                
+                uint64_t bits = 0;
+                int filled = 0;
+                size_t next_byte = 0;
+                uint64_t mask = (uint64_t(1) << width) - 1;
+                for (size_t i = 0; i < n; ++i) {
+                    while (filled < width) {
+                        bits |= static_cast<uint64_t>(packed[next_byte++]) << filled;
+                        filled += 8;
+                    }
+                    previous += static_cast<uint32_t>(bits & mask);
+                    bits >>= width;
+                    filled -= width;
+                    out.push_back(previous * RADIUS_SCALE);
+                }
+            }
+            return true;
+        }
+        
+        template <typename T>
+        static bool decode_scaled(istream& in, size_t count, Encoding encoding, double scale, vector<double>& out) {
+            constexpr double top = numeric_limits<T>::max();
+            unsigned char raw[BLOCK * sizeof(T)];
+            for (size_t begin = 0; begin < count; begin += BLOCK) {
+                size_t n = min(BLOCK, count - begin);
+                if (!in.read(reinterpret_cast<char*>(raw), n * sizeof(T))) return false;
+                for (size_t i = 0; i < n; ++i) {
+                    uint32_t v = 0;
+                    for (size_t b = 0; b < sizeof(T); ++b) v |= uint32_t(raw[i * sizeof(T) + b]) << (8 * b);
+                    out.push_back(from_unit(encoding, v / top, scale));
+                }
+            }
+            return true;
+        }
+        
+        // Stable, so verify() can recompute the order write() used.
+        static vector<uint32_t> radius_order(const ParticleStore& particles) {
+            vector<uint32_t> order(particles.size());
+            iota(order.begin(), order.end(), 0);
+            stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return particles.radius[a] < particles.radius[b];
+            });
+            return order;
+        }
+        
+        static double largest_magnitude(const vector<double>& values) {
+            double largest = 0;
+            for (double v : values) largest = max(largest, abs(v));
+            return largest;
+        }
+        
+        static bool has_negative(const vector<double>& values) {
+            return any_of(values.begin(), values.end(), [](double v) { return v < 0; });
+        }
+        
+    public:
+        static bool write(const string& path, const ParticleStore& particles) {
+            vector<uint32_t> order = radius_order(particles);
+            
+            vector<uint32_t> radius(order.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                double q = round(max(particles.radius[order[i]], 0.0) / RADIUS_SCALE);
+                radius[i] = static_cast<uint32_t>(min(q, 4294967295.0));
+            }
+            
+            // Scales go through f32 in the header; encode with the value the
+            // decoder will see.
+            float omega_scale = static_cast<float>(largest_magnitude(particles.angular_velocity));
+            float brightness_scale = static_cast<float>(largest_magnitude(particles.brightness));
+            Encoding omega = has_negative(particles.angular_velocity) ? SIGNED_U16 : SCALED_U16;
+            Encoding brightness = has_negative(particles.brightness) ? SIGNED_U8 : SCALED_U8;
+            
+            ofstream out(path, ios::binary);
+            out.write("SPSNAP01", 8);
+            write_le<uint64_t>(out, particles.size());
+            write_column(out, 0, DELTA_BITPACK, RADIUS_SCALE, encode_deltas(radius));
+            write_column(out, 1, TURN_U16, static_cast<float>(TWO_PI),
+                         encode_scaled<uint16_t>(particles.angle, order, TURN_U16, static_cast<float>(TWO_PI)));
+            write_column(out, 2, omega, omega_scale,
+                         encode_scaled<uint16_t>(particles.angular_velocity, order, omega, omega_scale));
+            write_column(out, 3, brightness, brightness_scale,
+                         encode_scaled<uint8_t>(particles.brightness, order, brightness, brightness_scale));
+            return static_cast<bool>(out);
+        }
+        
+        // Expects the stream positioned just past the magic.
+        static bool read(istream& in, ParticleStore& out) {
+            uint64_t count;
+            if (!read_le(in, count)) return false;
+            // A count the rest of the file cannot hold is corrupt and must
+            // not size any allocation.
+            auto here = in.tellg();
+            in.seekg(0, ios::end);
+            auto end = in.tellg();
+            in.seekg(here);
+            if (here < 0 || end < here || count > static_cast<uint64_t>(end - here) / MIN_PARTICLE_BYTES) return false;
+            
+            ParticleStore decoded;
+            decoded.reserve(count);
+            vector<double>* columns[] = {&decoded.radius, &decoded.angle,
+                                         &decoded.angular_velocity, &decoded.brightness};
+            
+            for (int c = 0; c < 4; ++c) {
+                int column = in.get();
+                int encoding = in.get();
+                uint32_t scale_bits;
+                uint64_t payload_bytes;
+                if (column != c || !read_le(in, scale_bits) || !read_le(in, payload_bytes)) return false;
+                float scale;
+                memcpy(&scale, &scale_bits, sizeof(scale));
+                
+                bool ok = false;
+                switch (encoding) {
+                    case DELTA_BITPACK: ok = decode_deltas(in, count, *columns[c]); break;
+                    case TURN_U16:
+                    case SCALED_U16:
+                    case SIGNED_U16:
+                        ok = decode_scaled<uint16_t>(in, count, Encoding(encoding), scale, *columns[c]);
+                        break;
+                    case SCALED_U8:
+                    case SIGNED_U8:
+                        ok = decode_scaled<uint8_t>(in, count, Encoding(encoding), scale, *columns[c]);
+                        break;
+                }
+                if (!ok) return false;
+            }
+            
+            if (out.size() == 0) out = move(decoded);
+            else out.append(decoded);
+            return true;
+        }
+        
+        // Reads path back and checks every value against particles to within
+        // one quantisation step, so an export that loses data (a sign, an
+        // out-of-range angle) fails when written rather than when imported.
+        static bool verify(const string& path, const ParticleStore& particles) {
+            ifstream in(path, ios::binary);
+            char magic[8];
+            ParticleStore decoded;
+            if (!in.read(magic, sizeof(magic)) || memcmp(magic, "SPSNAP01", 8) != 0 || !read(in, decoded)) return false;
+            if (decoded.size() != particles.size()) return false;
+            
+            vector<uint32_t> order = radius_order(particles);
+            const double omega_step = largest_magnitude(particles.angular_velocity) * 1.0001 / 65535;
+            const double brightness_step = largest_magnitude(particles.brightness) * 1.0001 / 255;
+            for (size_t k = 0; k < order.size(); ++k) {
+                uint32_t i = order[k];
+                if (abs(decoded.radius[k] - max(particles.radius[i], 0.0)) > RADIUS_SCALE) return false;
+                if (abs(remainder(decoded.angle[k] - particles.angle[i], TWO_PI)) > TWO_PI / 65535) return false;
+                if (abs(decoded.angular_velocity[k] - particles.angular_velocity[i]) > omega_step) return false;
+                if (abs(decoded.brightness[k] - particles.brightness[i]) > brightness_step) return false;
+            }
+            return true;
+        }
+    };
+    
+    // Star catalogs as text, one "x,y,brightness[,angular_velocity]" row per
+    // star in galaxy units around the center. Blank lines, '#' comments and
+    // a non-numeric header line are skipped; the angular velocity defaults
+    // to the same rotation curve the procedural arms use.
+    class CsvImporter {
+    private:
+        static const char* skip_blanks(const char* p, const char* end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+            return p;
+        }
+        
+        static bool parse_row(const char* p, const char* end, double (&fields)[4], int& count) {
+            count = 0;
+            while (count < 4) {
+                p = skip_blanks(p, end);
+                auto [next, ec] = from_chars(p, end, fields[count]);
+                if (ec != errc()) return false;
+                ++count;
+                p = skip_blanks(next, end);
+                if (p == end) break;
+                if (*p != ',') return false;
+                ++p;
+            }
+            return count >= 3 && skip_blanks(p, end) == end;
+        }
+        
+        // memchr is the vectorized scan here: glibc and the MSVC CRT both
+        // compare 16-32 bytes per step when looking for the line end.
+        static void parse_chunk(const char* begin, const char* end, ParticleStore& out, size_t& rejected) {
+            for (const char* line = begin; line < end;) {
+                const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+                const char* line_end = newline ? newline : end;
+                
+                const char* first = skip_blanks(line, line_end);
+                if (first != line_end && *first != '#') {
+                    double fields[4];
+                    int count;
+                    if (parse_row(first, line_end, fields, count)) {
+                        double radius = hypot(fields[0], fields[1]);
+                        double angle = atan2(fields[1], fields[0]);
+                        if (angle < 0) angle += TWO_PI;
+                        double angular_velocity = count == 4 ? fields[3] : 0.15 / sqrt(max(radius, 0.25));
+                        out.push_back(radius, angle, angular_velocity, fields[2]);
+                    } else {
+                        ++rejected;
+                    }
+                }
+                line = line_end + 1;
+            }
+        }
+        
+    public:
+        // Splits the text into pieces on line boundaries and parses them on
+        // the pool; pieces are concatenated in file order afterwards.
+        static size_t parse(string_view text, ThreadPool& pool, ParticleStore& out) {
+            const char* data = text.data();
+            const char* end = data + text.size();
+            
+            // A header line would count as rejected; drop it up front.
+            const char* body = skip_blanks(data, end);
+            if (body < end && !isdigit(static_cast<unsigned char>(*body)) &&
+                *body != '-' && *body != '+' && *body != '.' && *body != '#') {
+                const char* newline = static_cast<const char*>(memchr(body, '\n', end - body));
+                body = newline ? newline + 1 : end;
+            }
+            
+            size_t pieces = min<size_t>(pool.size() * 4, max<size_t>(1, (end - body) >> 20));
+            vector<const char*> bounds(pieces + 1, end);
+            bounds[0] = body;
+            for (size_t i = 1; i < pieces; ++i) {
+                const char* p = max(body + (end - body) * i / pieces, bounds[i - 1]);
+                const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+                bounds[i] = newline ? newline + 1 : end;
+            }
+            
+            vector<ParticleStore> parts(pieces);
+            vector<size_t> rejected(pieces, 0);
+            pool.parallel_for(pieces, [&](size_t i) {
+                parse_chunk(bounds[i], bounds[i + 1], parts[i], rejected[i]);
+            });
+            
+            size_t total = out.size();
+            for (const auto& part : parts) total += part.size();
+            out.reserve(total);
+            for (const auto& part : parts) out.append(part);
+            
+            size_t total_rejected = 0;
+            for (size_t r : rejected) total_rejected += r;
+            return total_rejected;
+        }
+    };
+    
+    // Loads a CSV star catalog, an SPCAT001 catalog or an SPSNAP01 snapshot.
+    // Catalogs and CSV are parsed straight from a mapping of the file, so
+    // parsing starts without a serial read and catalog columns are only
+    // touched once, to widen them into the store.
+    bool import_particles(const string& path, size_t threads, ParticleStore& out) {
+        ifstream in(path, ios::binary);
+        if (!in) return false;
+        
+        char magic[8] = {};
+        in.read(magic, sizeof(magic));
+        if (in && memcmp(magic, "SPSNAP01", 8) == 0) return Snapshot::read(in, out);
+        in.close();
+        
+#ifndef _WIN32
+        unique_ptr<MappedFile> file = MappedFile::open(path);
+        if (!file) return false;
+        ThreadPool pool(threads);
+        
+        if (file->view().starts_with("SPCAT001")) {
+            shared_ptr<MappedCatalog> catalog = MappedCatalog::from(move(file));
+            if (!catalog) return false;
+            const size_t offset = out.size();
+            const size_t count = catalog->count;
+            auto columns = {pair{&out.radius, catalog->radius}, pair{&out.angle, catalog->angle},
+                            pair{&out.angular_velocity, catalog->angular_velocity},
+                            pair{&out.brightness, catalog->brightness}};
+            for (auto [column, source] : columns) column->resize(offset + count);
+            ThreadPool::parallel_ranges(&pool, count, ThreadPool::GRAIN, [&](size_t, size_t begin, size_t end) {
+                for (auto [column, source] : columns) copy(source + begin, source + end, column->begin() + offset + begin);
+            });
+            return true;
+        }
+        
+        size_t rejected = CsvImporter::parse(file->view(), pool, out);
+#else
+        in.open(path, ios::binary);
+        string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        
+        if (text.compare(0, 8, "SPCAT001") == 0) {
+            uint64_t count = 0;
+            if (text.size() < 16) return false;
+            memcpy(&count, text.data() + 8, sizeof(count));
+            if (count > (text.size() - 16) / (4 * sizeof(float))) return false;
+            
+            vector<float> columns(4 * count);
+            memcpy(columns.data(), text.data() + 16, columns.size() * sizeof(float));
+            text.clear();
+            text.shrink_to_fit();
+            
+            out.reserve(out.size() + count);
+            for (size_t i = 0; i < count; ++i) {
+                out.push_back(columns[i], columns[count + i], columns[2 * count + i], columns[3 * count + i]);
+            }
+            return true;
+        }
+        
+        ThreadPool pool(threads);
+        size_t rejected = CsvImporter::parse(text, pool, out);
+#endif
+        if (rejected > 0) cerr << path << ": skipped " << rejected << " malformed rows\n";
+        return true;
+    }
+    
+    struct SweepOptions {
+        vector<int64_t> seeds{42};
+        vector<int64_t> arms{2};
+        vector<int64_t> particles{150};
+        int frames = 100;
+        int width = 80;
+        int height = 24;
+        size_t threads = max(1u, thread::hardware_concurrency());
+        string out = "sweep.bin";
+        int thumbnail_level = 0;
+    };
+    
+    struct Options {
+        bool sweep = false;
+        bool bench = false;
+        bool bench_matrix = false;
+        bool bench_queues = false;
+        bool bench_snapshots = false;
+        bool bench_console = false;
+        bool bench_accumulate = false;
+        bool bench_sort = false;
+        bool bench_reorder = false;
+        bool bench_neighbours = false;
+        CurveOrder reorder = CurveOrder::None;
+        int gas_particles = 0;
+        bool perf = false;
+        bool json = false;
+        int64_t max_particles = 1000000;
+        int workers = 0;
+        string catalog;
+        string export_catalog;
+        string export_snapshot;
+        string import_path;
+        string latency_log;
+        string output = "tty";
+        int serve_port = 0;
+        int canvas_width = 640;
+        int canvas_height = 400;
+        SweepOptions sweep_options;
+    };
+    
+    // Single-galaxy modes use the first value of each grid list.
+    GalaxyParams first_grid_params(const SweepOptions& grid) {
+        GalaxyParams params;
+        params.seed = static_cast<uint32_t>(grid.seeds.front());
+        params.num_arms = static_cast<int>(max<int64_t>(grid.arms.front(), 1));
+        params.particles_per_arm = static_cast<int>(max<int64_t>(grid.particles.front(), 0));
+        return params;
+    }
+    
+    // The first grid galaxy with its arms sized so that arms and core
+    // together hold about n particles, for benches that sweep the count.
+    GalaxyParams params_for_particles(const SweepOptions& grid, int64_t n) {
+        GalaxyParams params = first_grid_params(grid);
+        params.particles_per_arm = static_cast<int>(max<int64_t>(0, n - params.core_particles) / params.num_arms);
+        return params;
+    }
+    
+    // Accepts "a:b" (inclusive range) or "a,b,c".
+    bool parse_list(const string& text, vector<int64_t>& out) {
+        out.clear();
+        try {
+            size_t colon = text.find(':');
+            if (colon != string::npos) {
+                int64_t first = stoll(text.substr(0, colon));
+                int64_t last = stoll(text.substr(colon + 1));
+                for (int64_t v = first; v <= last; ++v) out.push_back(v);
+            } else {
+                stringstream ss(text);
+                string item;
+                while (getline(ss, item, ',')) out.push_back(stoll(item));
+            }
+        } catch (const exception&) {
+            return false;
+        }
+        return !out.empty();
+    }
+    
+    bool parse_size(const string& text, int& width, int& height) {
+        return sscanf(text.c_str(), "%dx%d", &width, &height) == 2 && width > 2 && height > 0;
+    }
+    
+    bool parse_options(int argc, char** argv, Options& options) {
+        SweepOptions& sweep = options.sweep_options;
+        for (int i = 1; i < argc; ++i) {
+            string_view arg = argv[i];
+            bool has_value = i + 1 < argc;
+            
+            if (arg == "--sweep") {
+                options.sweep = true;
+            } else if (arg == "--bench") {
+                options.bench = true;
+            } else if (arg == "--perf") {
+                options.perf = true;
+            } else if (arg == "--bench-matrix") {
+                options.bench_matrix = true;
+            } else if (arg == "--bench-queues") {
+                options.bench_queues = true;
+            } else if (arg == "--bench-snapshots") {
+                options.bench_snapshots = true;
+            } else if (arg == "--bench-console") {
+                options.bench_console = true;
+            } else if (arg == "--bench-accumulate") {
+                options.bench_accumulate = true;
+            } else if (arg == "--bench-sort") {
+                options.bench_sort = true;
+            } else if (arg == "--gas" && has_value) {
+                options.gas_particles = max(0, atoi(argv[++i]));
+            } else if (arg == "--bench-reorder") {
+                options.bench_reorder = true;
+            } else if (arg == "--bench-neighbours") {
+                options.bench_neighbours = true;
+            } else if (arg == "--reorder" && has_value) {
+                string_view curve = argv[++i];
+                auto name = find(begin(CURVE_ORDER_NAMES), end(CURVE_ORDER_NAMES), curve);
+                if (name == end(CURVE_ORDER_NAMES)) return false;
+                options.reorder = static_cast<CurveOrder>(name - begin(CURVE_ORDER_NAMES));
+            } else if (arg == "--max-particles" && has_value) {
+                options.max_particles = max<int64_t>(1000, atoll(argv[++i]));
+            } else if (arg == "--format" && has_value) {
+                string_view format = argv[++i];
+                if (format != "csv" && format != "json") return false;
+                options.json = format == "json";
+            } else if (arg == "--seeds" && has_value) {
+                if (!parse_list(argv[++i], sweep.seeds)) return false;
+            } else if (arg == "--arms" && has_value) {
+                if (!parse_list(argv[++i], sweep.arms)) return false;
+            } else if (arg == "--particles" && has_value) {
+                if (!parse_list(argv[++i], sweep.particles)) return false;
+            } else if (arg == "--frames" && has_value) {
+                sweep.frames = atoi(argv[++i]);
+                if (sweep.frames < 1) return false;
+            } else if (arg == "--size" && has_value) {
+                if (!parse_size(argv[++i], sweep.width, sweep.height)) return false;
+            } else if (arg == "--threads" && has_value) {
+                sweep.threads = max(1, atoi(argv[++i]));
+            } else if (arg == "--serve" && has_value) {
+                options.serve_port = atoi(argv[++i]);
+                if (options.serve_port <= 0 || options.serve_port > 65535) return false;
+            } else if (arg == "--canvas" && has_value) {
+                if (!parse_size(argv[++i], options.canvas_width, options.canvas_height)) return false;
+            } else if (arg == "--output" && has_value) {
+                options.output = argv[++i];
+            } else if (arg == "--out" && has_value) {
+                sweep.out = argv[++i];
+            } else if (arg == "--thumbnail-level" && has_value) {
+                sweep.thumbnail_level = clamp(atoi(argv[++i]), 0, MAX_ZOOM);
+            } else if (arg == "--catalog" && has_value) {
+                options.catalog = argv[++i];
+            } else if (arg == "--import" && has_value) {
+                options.import_path = argv[++i];
+            } else if (arg == "--export-catalog" && has_value) {
+                options.export_catalog = argv[++i];
+            } else if (arg == "--export-snapshot" && has_value) {
+                options.export_snapshot = argv[++i];
+            } else if (arg == "--latency-log" && has_value) {
+                options.latency_log = argv[++i];
+            } else if (arg == "--workers" && has_value) {
+                options.workers = max(0, atoi(argv[++i]));
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    void print_usage() {
+        cerr << "Usage: Spiralis [--workers N] [--sweep | --bench [--perf]] [options]\n"
+                "  --bench             time each stage headlessly for --frames frames\n"
+                "  --perf              add hardware counters to --bench (Linux)\n"
+                "  --bench-matrix      strong/weak scaling over particles, sizes, threads\n"
+                "  --max-particles N   largest matrix particle count (default 1000000)\n"
+                "  --bench-queues      SPSC/MPMC handoff throughput and round trip\n"
+                "  --bench-snapshots   stress seqlock snapshots with concurrent readers\n"
+                "  --bench-console     time the Windows console frame path on a mock\n"
+                "  --bench-accumulate  compare private-plane, atomic and sort-reduce\n"
+                "                      parallel accumulation (up to --max-particles)\n"
+                "  --bench-sort        radix sort --max-particles keys with and\n"
+                "                      without SoA columns\n"
+                "  --bench-reorder     accumulate a shuffled store vs. Morton and\n"
+                "                      Hilbert layouts (try --size 1000x300 --perf)\n"
+                "  --bench-neighbours  cell-list vs. brute-force radius search from\n"
+                "                      10^4 up to --max-particles points\n"
+                "  --gas N             add N SPH gas particles (e.g. 200000)\n"
+                "  --reorder CURVE     keep particles sorted along off (default),\n"
+                "                      morton or hilbert order\n"
+                "  --format csv|json   matrix output format (default csv)\n"
+                "  --workers N         split particles across N worker processes\n"
+                "  --serve PORT        stream to browsers at http://127.0.0.1:PORT/\n"
+                "  --canvas WxH        browser frame size (default 640x400)\n"
+                "  --output SPEC       frame destination: tty (default), null,\n"
+                "                      file:PATH, pipe:COMMAND or tcp:HOST:PORT\n"
+                "  --latency-log FILE  write per-frame pipeline timestamps as CSV\n"
+                "  --catalog FILE      stream an SPCAT001 particle catalog from disk\n"
+                "  --import FILE       load stars from a CSV (x,y,brightness[,omega]),\n"
+                "                      SPCAT001 or SPSNAP01 file instead of generating\n"
+                "  --export-catalog F  write the generated or imported galaxy (first\n"
+                "                      --seeds/--arms/--particles values) as a catalog\n"
+                "  --export-snapshot F same, as a compressed SPSNAP01 snapshot\n"
+                "  --sweep             render a parameter grid headlessly and exit\n"
+                "  --seeds LIST        seeds, \"a:b\" or \"a,b,c\" (default 42)\n"
+                "  --arms LIST         spiral arm counts (default 2)\n"
+                "  --particles LIST    particles per arm (default 150)\n"
+                "  --frames N          simulation steps before capture (default 100)\n"
+                "  --size WxH          frame size (default 80x24)\n"
+                "  --threads N         worker threads (default: all cores)\n"
+                "  --out FILE          output container (default sweep.bin)\n"
+                "  --thumbnail-level K store particle-only frames shrunk 2^K times\n";
+    }
+    
+    // Frames are mostly blank, so (count, char) runs shrink them several times.
+    string run_length_encode(const vector<string>& screen) {
+        string encoded;
+        for (const auto& line : screen) {
+            for (size_t i = 0; i < line.size();) {
+                size_t run = 1;
+                while (i + run < line.size() && run < 255 && line[i + run] == line[i]) ++run;
+                encoded += static_cast<char>(run);
+                encoded += line[i];
+                i += run;
+            }
+        }
+        return encoded;
+    }
+    
+    struct SweepEntry {
+        GalaxyParams params;
+        string frame;
+    };
+    
+    // Container layout (little endian):
+    //   "SPSWEEP1", u32 entry count, u16 width, u16 height, u32 frames
+    //   per entry: u32 seed, u16 arms, u32 particles per arm,
+    //              u32 payload bytes, payload of (u8 run, u8 char) pairs
+    bool write_sweep(const SweepOptions& options, const vector<SweepEntry>& entries) {
+        ofstream out(options.out, ios::binary);
+        out.write("SPSWEEP1", 8);
+        write_le<uint32_t>(out, entries.size());
+        write_le<uint16_t>(out, max(options.width >> options.thumbnail_level, 1));
+        write_le<uint16_t>(out, max(options.height >> options.thumbnail_level, 1));
+        write_le<uint32_t>(out, options.frames);
+        
+        for (const auto& entry : entries) {
+            write_le<uint32_t>(out, entry.params.seed);
+            write_le<uint16_t>(out, entry.params.num_arms);
+            write_le<uint32_t>(out, entry.params.particles_per_arm);
+            write_le<uint32_t>(out, entry.frame.size());
+            out.write(entry.frame.data(), entry.frame.size());
+        }
+        return static_cast<bool>(out);
+    }
+    
+    int run_sweep(const SweepOptions& options) {
+        constexpr double dt = 0.1;
+        
+        vector<SweepEntry> entries;
+        for (int64_t seed : options.seeds) {
+            for (int64_t arms : options.arms) {
+                for (int64_t particles : options.particles) {
+                    SweepEntry entry;
+                    entry.params.seed = static_cast<uint32_t>(seed);
+                    entry.params.num_arms = static_cast<int>(max<int64_t>(arms, 1));
+                    entry.params.particles_per_arm = static_cast<int>(max<int64_t>(particles, 0));
+                    entries.push_back(entry);
+                }
+            }
+        }
+        
+        auto start = chrono::steady_clock::now();
+        
+        // Every task owns its Galaxy outright, so workers share nothing but
+        // the result slot they write to.
+        ThreadPool pool(options.threads);
+        pool.parallel_for(entries.size(), [&](size_t i) {
+            Galaxy galaxy(options.width, options.height, entries[i].params);
+            for (int f = 0; f < options.frames; ++f) galaxy.update(dt);
+            entries[i].frame = run_length_encode(options.thumbnail_level > 0 ? galaxy.thumbnail(options.thumbnail_level)
+                                                                             : galaxy.compose());
+        });
+        
+        double seconds = elapsed_ms(start) / 1000.0;
+        if (!write_sweep(options, entries)) {
+            cerr << "Failed to write " << options.out << '\n';
+            return 1;
+        }
+        
+        cerr << entries.size() << " galaxies in " << seconds << " s ("
+             << entries.size() / max(seconds, 1e-9) << "/s) on " << pool.size()
+             << " threads -> " << options.out << '\n';
+        return 0;
+    }
+    
+    int run_bench(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        GalaxyParams params = first_grid_params(grid);
+        params.gas_particles = options.gas_particles;
+        
+        ParticleStore imported;
+        if (!options.import_path.empty()) {
+            if (!import_particles(options.import_path, grid.threads, imported)) {
+                cerr << "Cannot read " << options.import_path << '\n';
+                return 1;
+            }
+            params.particles_per_arm = 0;
+            params.core_particles = 0;
+        }
+        Galaxy galaxy(grid.width, grid.height, params);
+        galaxy.add_particles(move(imported));
+        PerfCounters perf(options.perf);
+        ThreadPool pool(grid.threads);
+        galaxy.set_thread_pool(&pool);
+        galaxy.set_reorder(options.reorder);
+        
+        struct Stage {
+            const char* name;
+            const char* unit;
+            double items;
+            double ms = 0;
+            PerfCounters::Values counts{};
+        };
+        const double particles = static_cast<double>(galaxy.particles().size());
+        const double gas = static_cast<double>(galaxy.gas_particles());
+        const double cells = static_cast<double>(grid.width) * grid.height;
+        // Gas is timed apart from the stars, per gas particle, so neither
+        // skews the other's per-item figures.
+        Stage stages[] = {
+            {"update", "particle", particles},
+            {"accumulate", "particle", particles},
+            {"gas step", "gas particle", gas},
+            {"gas splat", "gas particle", gas},
+            {"shade", "cell", cells},
+        };
+        
+        auto measure = [&](Stage& stage, auto&& body) {
+            perf.start();
+            auto start = chrono::steady_clock::now();
+            body();
+            stage.ms += elapsed_ms(start);
+            perf.stop(stage.counts);
+        };
+        
+        constexpr double dt = 0.1;
+        const int frames = max(grid.frames, 1);
+        for (int f = 0; f < frames; ++f) {
+            IntensityPlane intensity(grid.width, grid.height);
+            RenderStats stats;
+            measure(stages[0], [&] { galaxy.update_stars(dt); });
+            measure(stages[1], [&] { galaxy.accumulate_stars(intensity, 0); });
+            if (gas > 0) {
+                measure(stages[2], [&] { galaxy.step_gas(dt); });
+                measure(stages[3], [&] { galaxy.accumulate_gas(intensity); });
+            }
+            measure(stages[4], [&] { galaxy.shade(intensity, 0, stats); });
+        }
+        
+        cout << galaxy.particles().size() << " particles";
+        if (gas > 0) cout << " + " << galaxy.gas_particles() << " gas";
+        cout << ", " << grid.width << "x" << grid.height << ", " << frames << " frames, " << pool.size() << " threads\n";
+        if (options.perf && !perf.any_available()) {
+            cout << "hardware counters unavailable (" << perf.error() << "), timings only\n";
+        }
+        
+        cout << left << setw(12) << "stage" << right << setw(10) << "ms/frame" << setw(10) << "ns/item";
+        for (size_t i = 0; i < PerfCounters::COUNT; ++i) {
+            if (perf.available(i)) cout << setw(14) << PerfCounters::NAMES[i];
+        }
+        cout << "  (per item)\n" << fixed;
+        
+        for (const Stage& stage : stages) {
+            if (stage.items == 0) continue;
+            double items = stage.items * frames;
+            cout << left << setw(12) << stage.name << right << setprecision(3)
+                 << setw(10) << stage.ms / frames << setw(10) << stage.ms * 1e6 / items;
+            for (size_t i = 0; i < PerfCounters::COUNT; ++i) {
+                if (perf.available(i)) cout << setw(14) << stage.counts[i] / items;
+            }
+            cout << "  /" << stage.unit << '\n';
+        }
+        return 0;
+    }
+    
+    struct ScalingPoint {
+        const char* mode;
+        size_t particles;
+        int width;
+        int height;
+        size_t threads;
+        int frames;
+        double update_ms;
+        double accumulate_ms;
+        double shade_ms;
+        
+        double frame_ms() const { return update_ms + accumulate_ms + shade_ms; }
+    };
+    
+    // Runs frames until about a quarter second has been measured (at least
+    // three, at most max_frames) after one warm-up frame.
+    ScalingPoint measure_scaling(const char* mode, Galaxy& galaxy, ThreadPool& pool,
+                                 int width, int height, int max_frames) {
+        constexpr double dt = 0.1;
+        galaxy.set_thread_pool(&pool);
+        ScalingPoint point{mode, galaxy.particles().size(), width, height, pool.size(), 0, 0, 0, 0};
+        
+        IntensityPlane intensity(width, height);
+        RenderStats stats;
+        galaxy.accumulate(intensity, 0);
+        
+        auto start = chrono::steady_clock::now();
+        while (point.frames < max(max_frames, 3) && (point.frames < 3 || elapsed_ms(start) < 250)) {
+            auto stage_start = chrono::steady_clock::now();
+            galaxy.update(dt);
+            point.update_ms += elapsed_ms(stage_start);
+            
+            fill(intensity.cells.begin(), intensity.cells.end(), 0.0f);
+            stage_start = chrono::steady_clock::now();
+            galaxy.accumulate(intensity, 0);
+            point.accumulate_ms += elapsed_ms(stage_start);
+            
+            stage_start = chrono::steady_clock::now();
+            galaxy.shade(intensity, 0, stats);
+            point.shade_ms += elapsed_ms(stage_start);
+            ++point.frames;
+        }
+        
+        point.update_ms /= point.frames;
+        point.accumulate_ms /= point.frames;
+        point.shade_ms /= point.frames;
+        return point;
+    }
+    
+    // Accumulates a shuffled particle store as is and after sorting it along
+    // each curve, with hardware cache counters when --perf can open them.
+    // Imported catalogs arrive in arbitrary order, which the shuffle mimics.
+    int run_bench_reorder(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        GalaxyParams params = params_for_particles(grid, options.max_particles);
+        
+        ParticleStore shuffled = Galaxy(grid.width, grid.height, params).particles();
+        {
+            mt19937 rng(7);
+            vector<uint32_t> keys(shuffled.size());
+            for (auto& key : keys) key = rng();
+            RadixSort<double, double, double, double> sorter;
+            sorter.sort(nullptr, 32, keys, shuffled.radius, shuffled.angle, shuffled.angular_velocity,
+                        shuffled.brightness);
+        }
+        params.particles_per_arm = 0;
+        params.core_particles = 0;
+        
+        PerfCounters perf(options.perf);
+        ThreadPool pool(grid.threads);
+        const int frames = max(grid.frames, 1);
+        cout << shuffled.size() << " particles, " << grid.width << "x" << grid.height << ", " << frames
+             << " frames, " << pool.size() << " threads\n";
+        if (options.perf && !perf.any_available()) {
+            cout << "hardware counters unavailable (" << perf.error() << "), timings only\n";
+        }
+        cout << left << setw(10) << "order" << right << setw(12) << "reorder ms" << setw(14) << "accumulate ms";
+        for (size_t i = 0; i < PerfCounters::COUNT; ++i) {
+            if (perf.available(i)) cout << setw(14) << PerfCounters::NAMES[i];
+        }
+        cout << "  (per particle)\n" << fixed << setprecision(3);
+        
+        for (CurveOrder order : {CurveOrder::None, CurveOrder::Morton, CurveOrder::Hilbert}) {
+            Galaxy galaxy(grid.width, grid.height, params);
+            galaxy.add_particles(shuffled);
+            galaxy.set_thread_pool(&pool);
+            // Stride 2 takes the plain scatter path, which is where layout
+            // shows; full detail would reuse last frame's binning.
+            constexpr int QUALITY = 2;
+            
+            auto start = chrono::steady_clock::now();
+            galaxy.reorder_particles(order);
+            double reorder_ms = elapsed_ms(start);
+            
+            IntensityPlane intensity(grid.width, grid.height);
+            galaxy.accumulate(intensity, QUALITY);
+            PerfCounters::Values counts{};
+            double ms = 0;
+            for (int f = 0; f < frames; ++f) {
+                fill(intensity.cells.begin(), intensity.cells.end(), 0.0f);
+                perf.start();
+                start = chrono::steady_clock::now();
+                galaxy.accumulate(intensity, QUALITY);
+                ms += elapsed_ms(start);
+                perf.stop(counts);
+            }
+            
+            double items = static_cast<double>(galaxy.particles().size()) / QUALITY_LEVELS[QUALITY].particle_stride * frames;
+            cout << left << setw(10) << CURVE_ORDER_NAMES[static_cast<int>(order)] << right << setw(12)
+                 << reorder_ms << setw(14) << ms / frames;
+            for (size_t i = 0; i < PerfCounters::COUNT; ++i) {
+                if (perf.available(i)) cout << setw(14) << counts[i] / items;
+            }
+            cout << '\n';
+        }
+        return 0;
+    }
+    
+    // Builds a cell list over 10^4 .. --max-particles uniform points and
+    // counts every point's neighbours within a radius that averages about
+    // 30, against brute-force O(N^2) search. Past NAIVE_FULL points the
+    // brute force runs on an even sample of queries and is extrapolated;
+    // the sampled counts must match the cell list's exactly.
+    int run_bench_neighbours(const Options& options) {
+        constexpr size_t NAIVE_FULL = 20000;
+        constexpr size_t NAIVE_SAMPLE = 2000;
+        constexpr double NEIGHBOURS = 30.0;
+        const size_t largest = static_cast<size_t>(options.max_particles);
+        ThreadPool pool(options.sweep_options.threads);
+        mt19937 rng(42);
+        uniform_real_distribution<double> unit(-1.0, 1.0);
+        
+        cout << pool.size() << " threads\n"
+             << "particles,radius,build_ms,query_ms,naive_ms,naive_estimated,speedup,mean_neighbours,match\n";
+        bool ok = true;
+        for (size_t count = 10000; count <= largest; count *= 10) {
+            vector<double> x(count), y(count);
+            for (size_t i = 0; i < count; ++i) {
+                x[i] = unit(rng);
+                y[i] = unit(rng);
+            }
+            // Over the 2x2 square, pi r^2 count / 4 neighbours on average.
+            const double radius = sqrt(4 * NEIGHBOURS / (PI * count));
+            
+            // The first build sizes the buffers; the second is timed.
+            CellList cells(1.0, radius);
+            double build_ms = 0;
+            for (int run = 0; run < 2; ++run) {
+                auto start = chrono::steady_clock::now();
+                cells.build(&pool, x.data(), y.data(), count);
+                build_ms = elapsed_ms(start);
+            }
+            
+            const vector<uint32_t>& order = cells.order();
+            vector<double> sorted_x(count), sorted_y(count);
+            for (size_t k = 0; k < count; ++k) {
+                sorted_x[k] = x[order[k]];
+                sorted_y[k] = y[order[k]];
+            }
+            vector<uint32_t> found(count);
+            auto start = chrono::steady_clock::now();
+            ThreadPool::parallel_ranges(&pool, count, CellList::QUERY_GRAIN, [&](size_t, size_t begin, size_t end) {
+                for (size_t k = begin; k < end; ++k) {
+                    uint32_t n = 0;
+                    cells.for_each_within(sorted_x.data(), sorted_y.data(), sorted_x[k], sorted_y[k], radius,
+                                          [&](uint32_t, double, double, double) { ++n; });
+                    found[order[k]] = n;
+                }
+            });
+            double query_ms = elapsed_ms(start);
+            
+            const size_t queries = count <= NAIVE_FULL ? count : NAIVE_SAMPLE;
+            const size_t stride = count / queries;
+            const double r2_max = radius * radius;
+            vector<uint32_t> naive(queries);
+            start = chrono::steady_clock::now();
+            // Each brute-force query scans every point, so one is a task's worth.
+            ThreadPool::parallel_ranges(&pool, queries, 1, [&](size_t, size_t begin, size_t end) {
+                for (size_t q = begin; q < end; ++q) {
+                    const size_t i = q * stride;
+                    uint32_t n = 0;
+                    for (size_t j = 0; j < count; ++j) {
+                        double dx = x[i] - x[j];
+                        double dy = y[i] - y[j];
+                        n += dx * dx + dy * dy < r2_max;
+                    }
+                    naive[q] = n;
+                }
+            });
+            double naive_ms = elapsed_ms(start) * count / queries;
+            
+            bool match = true;
+            for (size_t q = 0; q < queries && match; ++q) match = naive[q] == found[q * stride];
+            ok = ok && match;
+            double mean = accumulate(found.begin(), found.end(), 0.0) / count;
+            cout << count << ',' << setprecision(6) << radius << ',' << fixed << setprecision(3) << build_ms << ','
+                 << query_ms << ',' << naive_ms << ',' << (queries < count ? "yes" : "no") << ','
+                 << setprecision(1) << naive_ms / (build_ms + query_ms) << ',' << mean << ','
+                 << (match ? "yes" : "NO") << '\n'
+                 << defaultfloat;
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // Sorts --max-particles random keys alone and with four double columns
+    // riding along, as when reordering a particle store.
+    int run_bench_sort(const Options& options) {
+        const size_t count = static_cast<size_t>(options.max_particles);
+        ThreadPool pool(options.sweep_options.threads);
+        mt19937 rng(42);
+        vector<uint32_t> source(count);
+        for (auto& key : source) key = rng();
+        
+        auto report = [&](const char* name, int bits, double ms, bool sorted) {
+            cout << left << setw(20) << name << right << setw(3) << bits << " bits  " << fixed << setprecision(2)
+                 << setw(9) << ms << " ms  " << setw(8) << count / ms / 1e3 << " Mkeys/s"
+                 << (sorted ? "" : "  NOT SORTED") << '\n';
+        };
+        cout << count << " keys, " << pool.size() << " threads\n";
+        
+        bool ok = true;
+        for (int bits : {16, 32}) {
+            const uint32_t mask = bits == 32 ? ~0u : (1u << bits) - 1;
+            // The first sort of each pair sizes the scratch buffers; the
+            // second is timed.
+            RadixSort<> keys_only;
+            vector<uint32_t> keys(count);
+            double ms = 0;
+            for (int run = 0; run < 2; ++run) {
+                for (size_t i = 0; i < count; ++i) keys[i] = source[i] & mask;
+                auto start = chrono::steady_clock::now();
+                keys_only.sort(&pool, bits, keys);
+                ms = elapsed_ms(start);
+            }
+            bool sorted = is_sorted(keys.begin(), keys.end());
+            report("keys", bits, ms, sorted);
+            ok = ok && sorted;
+            
+            RadixSort<double, double, double, double> with_columns;
+            vector<double> a(count), b(count), c(count), d(count);
+            for (int run = 0; run < 2; ++run) {
+                for (size_t i = 0; i < count; ++i) {
+                    keys[i] = source[i] & mask;
+                    a[i] = b[i] = c[i] = d[i] = keys[i];
+                }
+                auto start = chrono::steady_clock::now();
+                with_columns.sort(&pool, bits, keys, a, b, c, d);
+                ms = elapsed_ms(start);
+            }
+            // Every column must have followed its key.
+            sorted = is_sorted(keys.begin(), keys.end());
+            for (size_t i = 0; i < count && sorted; ++i) sorted = a[i] == keys[i] && d[i] == keys[i];
+            report("keys + 4 columns", bits, ms, sorted);
+            ok = ok && sorted;
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // Times each parallel accumulation strategy over a grid of particle
+    // counts and plane sizes, then Auto once it has settled, next to its
+    // pick.
+    int run_bench_accumulate(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        const pair<int, int> sizes[] = {{80, 24}, {400, 120}, {1000, 300}};
+        const AccumulateMode modes[] = {AccumulateMode::PrivatePlanes, AccumulateMode::Atomic,
+                                        AccumulateMode::SortReduce};
+        ThreadPool pool(max<size_t>(grid.threads, 2));
+        
+        cout << "particles,width,height,threads";
+        for (AccumulateMode mode : modes) cout << ',' << ACCUMULATE_MODE_NAMES[static_cast<int>(mode)] << "_ms";
+        cout << ",auto_ms,auto_pick\n";
+        
+        for (int64_t n = 100000; n <= options.max_particles; n *= 10) {
+            Galaxy galaxy(80, 24, params_for_particles(grid, n));
+            galaxy.set_thread_pool(&pool);
+            
+            for (auto [width, height] : sizes) {
+                IntensityPlane intensity(width, height);
+                cout << galaxy.particles().size() << ',' << width << ',' << height << ',' << pool.size();
+                const int frames = max(grid.frames / 10, 3);
+                auto time_frames = [&] {
+                    auto start = chrono::steady_clock::now();
+                    for (int f = 0; f < frames; ++f) {
+                        fill(intensity.cells.begin(), intensity.cells.end(), 0.0f);
+                        galaxy.accumulate(intensity, 0);
+                    }
+                    return elapsed_ms(start) / frames;
+                };
+                for (AccumulateMode mode : modes) {
+                    galaxy.set_accumulate_mode(mode);
+                    galaxy.accumulate(intensity, 0);
+                    cout << ',' << time_frames();
+                }
+                galaxy.set_accumulate_mode(AccumulateMode::Auto);
+                while (galaxy.accumulate_mode_for(intensity) == AccumulateMode::Auto) galaxy.accumulate(intensity, 0);
+                cout << ',' << time_frames();
+                AccumulateMode pick = galaxy.accumulate_mode_for(intensity);
+                cout << ',' << ACCUMULATE_MODE_NAMES[static_cast<int>(pick)] << '\n';
+                cout.flush();
+            }
+        }
+        return 0;
+    }
+    
+    // Strong scaling keeps the problem fixed while threads grow; weak
+    // scaling grows the particle count with the threads. Speedup and
+    // efficiency compare against the single-thread run of the same row.
+    int run_bench_matrix(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        const pair<int, int> sizes[] = {{80, 24}, {200, 60}, {400, 120}, {1000, 300}};
+        
+        vector<int64_t> counts;
+        for (int64_t n = 1000; n <= options.max_particles; n *= 10) counts.push_back(n);
+        
+        vector<size_t> thread_counts;
+        for (size_t t = 1; t < grid.threads; t *= 2) thread_counts.push_back(t);
+        thread_counts.push_back(grid.threads);
+        
+        vector<unique_ptr<ThreadPool>> pools;
+        for (size_t t : thread_counts) pools.push_back(make_unique<ThreadPool>(t));
+        
+        auto make_galaxy = [&](int64_t particles, int width, int height) {
+            return Galaxy(width, height, params_for_particles(grid, particles));
+        };
+        
+        if (options.json) cout << "[\n";
+        else cout << "mode,particles,width,height,threads,frames,update_ms,accumulate_ms,shade_ms,"
+                     "frame_ms,mparticles_per_s,speedup,efficiency\n";
+        bool first_row = true;
+        
+        auto emit = [&](const ScalingPoint& p, const ScalingPoint& baseline) {
+            double rate = p.particles / max(p.frame_ms(), 1e-9) / 1e3;
+            double speedup = baseline.frame_ms() / max(p.frame_ms(), 1e-9);
+            // Weak rows do threads-times the work of their baseline.
+            if (string_view(p.mode) == "weak") speedup *= static_cast<double>(p.particles) / baseline.particles;
+            double efficiency = speedup / p.threads;
+            
+            if (options.json) {
+                cout << (first_row ? "" : ",\n") << "  {\"mode\": \"" << p.mode << "\", \"particles\": " << p.particles
+                     << ", \"width\": " << p.width << ", \"height\": " << p.height
+                     << ", \"threads\": " << p.threads << ", \"frames\": " << p.frames
+                     << ", \"update_ms\": " << p.update_ms << ", \"accumulate_ms\": " << p.accumulate_ms
+                     << ", \"shade_ms\": " << p.shade_ms << ", \"frame_ms\": " << p.frame_ms()
+                     << ", \"mparticles_per_s\": " << rate << ", \"speedup\": " << speedup
+                     << ", \"efficiency\": " << efficiency << "}";
+            } else {
+                cout << p.mode << ',' << p.particles << ',' << p.width << ',' << p.height << ','
+                     << p.threads << ',' << p.frames << ',' << p.update_ms << ',' << p.accumulate_ms << ','
+                     << p.shade_ms << ',' << p.frame_ms() << ',' << rate << ',' << speedup << ','
+                     << efficiency << '\n';
+            }
+            cout.flush();
+            first_row = false;
+        };
+        
+        for (auto [width, height] : sizes) {
+            for (int64_t n : counts) {
+                Galaxy galaxy = make_galaxy(n, width, height);
+                ScalingPoint baseline{};
+                for (size_t t = 0; t < pools.size(); ++t) {
+                    ScalingPoint point = measure_scaling("strong", galaxy, *pools[t], width, height, grid.frames);
+                    if (t == 0) baseline = point;
+                    emit(point, baseline);
+                }
+            }
+            
+            for (int64_t n : counts) {
+                ScalingPoint baseline{};
+                for (size_t t = 0; t < pools.size(); ++t) {
+                    int64_t total = n * static_cast<int64_t>(thread_counts[t]);
+                    if (total > options.max_particles) break;
+                    Galaxy galaxy = make_galaxy(total, width, height);
+                    ScalingPoint point = measure_scaling("weak", galaxy, *pools[t], width, height, grid.frames);
+                    if (t == 0) baseline = point;
+                    emit(point, baseline);
+                }
+            }
+        }
+        
+        if (options.json) cout << "\n]\n";
+        return 0;
+    }
+    
+    // Moves items from producers to consumers and returns ns per item.
+    // Producers push distinct values; the checksum proves none got lost.
+    template <typename Queue>
+    double bench_queue_throughput(size_t producers, size_t consumers, size_t items, size_t batch) {
+        constexpr uint64_t STOP = ~uint64_t(0);
+        Queue queue(4096);
+        atomic<uint64_t> checksum{0};
+        size_t per_producer = items / producers;
+        
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (size_t c = 0; c < consumers; ++c) {
+            threads.emplace_back([&] {
+                vector<uint64_t> buffer(batch);
+                uint64_t sum = 0;
+                while (true) {
+                    size_t n = queue.pop_batch(buffer.data(), batch);
+                    for (size_t i = 0; i < n; ++i) {
+                        if (buffer[i] == STOP) {
+                            // Hand any items popped with the stop marker back.
+                            for (size_t j = i + 1; j < n; ++j) queue.push(buffer[j]);
+                            checksum += sum;
+                            return;
+                        }
+                        sum += buffer[i];
+                    }
+                }
+            });
+        }
+        
+        vector<thread> producer_threads;
+        for (size_t p = 0; p < producers; ++p) {
+            producer_threads.emplace_back([&, p] {
+                vector<uint64_t> buffer(batch);
+                uint64_t next = p * per_producer + 1;
+                for (size_t sent = 0; sent < per_producer;) {
+                    size_t n = min(batch, per_producer - sent);
+                    for (size_t i = 0; i < n; ++i) buffer[i] = next++;
+                    queue.push_batch(buffer.data(), n);
+                    sent += n;
+                }
+            });
+        }
+        for (auto& t : producer_threads) t.join();
+        for (size_t c = 0; c < consumers; ++c) queue.push(STOP);
+        for (auto& t : threads) t.join();
+        double ns = elapsed_ms(start) * 1e6;
+        
+        uint64_t total = per_producer * producers;
+        if (checksum != total * (total + 1) / 2) cerr << "queue bench: checksum mismatch\n";
+        return ns / total;
+    }
+    
+    // Bounces one token between two threads; returns ns per round trip.
+    template <typename Wait>
+    double bench_queue_round_trip(size_t rounds) {
+        SpscQueue<uint64_t, Wait> ping(64);
+        SpscQueue<uint64_t, Wait> pong(64);
+        
+        thread echo([&] {
+            for (size_t i = 0; i < rounds; ++i) pong.push(ping.pop());
+        });
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; ++i) {
+            ping.push(i);
+            pong.pop();
+        }
+        double ns = elapsed_ms(start) * 1e6;
+        echo.join();
+        return ns / rounds;
+    }
+    
+    int run_bench_queues(const Options& options) {
+        constexpr size_t ITEMS = 2000000;
+        constexpr size_t ROUNDS = 100000;
+        size_t threads = max<size_t>(options.sweep_options.threads, 2);
+        size_t side = max<size_t>(threads / 2, 1);
+        
+        cout << left << setw(8) << "queue" << setw(8) << "wait" << right << setw(6) << "prod" << setw(6) << "cons"
+             << setw(7) << "batch" << setw(10) << "ns/item" << setw(12) << "Mitems/s" << '\n' << fixed;
+        auto row = [&](const char* queue, const char* wait, size_t p, size_t c, size_t batch, double ns) {
+            cout << left << setw(8) << queue << setw(8) << wait << right << setw(6) << p << setw(6) << c
+                 << setw(7) << batch << setprecision(1) << setw(10) << ns << setprecision(2)
+                 << setw(12) << 1e3 / ns << '\n';
+        };
+        
+        for (size_t batch : {size_t(1), size_t(32)}) {
+            row("spsc", SpinWait::NAME, 1, 1, batch,
+                bench_queue_throughput<SpscQueue<uint64_t, SpinWait>>(1, 1, ITEMS, batch));
+            row("spsc", FutexBackoffWait::NAME, 1, 1, batch,
+                bench_queue_throughput<SpscQueue<uint64_t, FutexBackoffWait>>(1, 1, ITEMS, batch));
+            row("mpmc", SpinWait::NAME, side, side, batch,
+                bench_queue_throughput<MpmcQueue<uint64_t, SpinWait>>(side, side, ITEMS, batch));
+            row("mpmc", FutexBackoffWait::NAME, side, side, batch,
+                bench_queue_throughput<MpmcQueue<uint64_t, FutexBackoffWait>>(side, side, ITEMS, batch));
+        }
+        
+        cout << setprecision(1) << "spsc round trip: " << bench_queue_round_trip<SpinWait>(ROUNDS) << " ns (spin), "
+             << bench_queue_round_trip<FutexBackoffWait>(ROUNDS) << " ns (futex)\n";
+        return 0;
+    }
+    
+    // Stress for SnapshotPublisher: one thread steps the galaxy as fast as
+    // it can while readers copy snapshots and verify each against its
+    // checksum and step order. Build with -DSPIRALIS_SANITIZE=thread to run
+    // it under TSan.
+    int run_bench_snapshots(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        Galaxy galaxy(grid.width, grid.height, first_grid_params(grid));
+        SnapshotPublisher& snapshots = galaxy.enable_snapshots();
+        
+        const size_t readers = max<size_t>(grid.threads, 2) - 1;
+        const int steps = max(grid.frames, 1) * 100;
+        atomic<bool> done{false};
+        atomic<uint64_t> reads{0};
+        atomic<uint64_t> torn{0};
+        
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (size_t r = 0; r < readers; ++r) {
+            threads.emplace_back([&] {
+                SnapshotPublisher::Snapshot snapshot;
+                uint64_t last_step = 0;
+                while (!done.load(memory_order_relaxed)) {
+                    snapshots.read(snapshot);
+                    double checksum = 0;
+                    for (double a : snapshot.angle) checksum += a;
+                    if (checksum != snapshot.checksum || snapshot.step < last_step) ++torn;
+                    last_step = snapshot.step;
+                    ++reads;
+                }
+            });
+        }
+        
+        for (int i = 0; i < steps; ++i) galaxy.update(0.1);
+        double writer_ms = elapsed_ms(start);
+        done = true;
+        for (auto& t : threads) t.join();
+        
+        cout << snapshots.size() << " particles, " << steps << " steps in " << writer_ms << " ms ("
+             << writer_ms * 1000 / steps << " us/step), " << readers << " readers: " << reads << " reads, "
+             << snapshots.retries() << " retries, " << torn << " torn\n";
+        return torn == 0 ? 0 : 1;
+    }
+    
+    // Stands in for the Windows console: counts calls and keeps the last
+    // write so the frame path can be checked and timed on any platform.
+    class RecordingConsole : public ConsoleApi {
+    public:
+        bool virtual_terminal = true;
+        size_t writes = 0;
+        size_t homes = 0;
+        size_t chars = 0;
+        wstring last;
+        
+        bool enable_virtual_terminal() override { return virtual_terminal; }
+        void move_cursor_home() override { ++homes; }
+        
+        bool write(const wchar_t* text, size_t length) override {
+            ++writes;
+            chars += length;
+            last.assign(text, length);
+            return true;
+        }
+    };
+    
+    int run_bench_console(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        Galaxy galaxy(grid.width, grid.height, first_grid_params(grid));
+        const int frames = max(grid.frames, 1);
+        
+        vector<string> encoded;
+        for (int f = 0; f < frames; ++f) {
+            string frame;
+            for (const auto& line : galaxy.compose()) frame += line + '\n';
+            encoded.push_back(move(frame));
+            galaxy.update(0.1);
+        }
+        
+        bool ok = true;
+        for (bool virtual_terminal : {true, false}) {
+            RecordingConsole console;
+            console.virtual_terminal = virtual_terminal;
+            ConsoleBackend backend(console);
+            
+            auto start = chrono::steady_clock::now();
+            for (const auto& frame : encoded) backend.write_frame(frame);
+            double ms = elapsed_ms(start);
+            
+            // One write per frame, ending with the frame text itself.
+            const string& last = encoded.back();
+            ok = ok && console.writes == encoded.size() && console.last.size() >= last.size() &&
+                 equal(last.begin(), last.end(), console.last.end() - last.size());
+            cout << (virtual_terminal ? "vt    " : "legacy") << "  " << frames << " frames, "
+                 << console.writes << " writes, " << console.homes << " cursor calls, "
+                 << console.chars / frames << " chars/frame, " << ms * 1000 / frames << " us/frame\n";
+        }
+        return ok ? 0 : 1;
+    }
+    
+    int run_export(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        GalaxyParams params = first_grid_params(grid);
+        
+        ParticleStore imported;
+        if (!options.import_path.empty()) {
+            auto start = chrono::steady_clock::now();
+            if (!import_particles(options.import_path, grid.threads, imported)) {
+                cerr << "Cannot read " << options.import_path << '\n';
+                return 1;
+            }
+            double seconds = elapsed_ms(start) / 1000.0;
+            cerr << imported.size() << " rows imported in " << seconds << " s ("
+                 << imported.size() / max(seconds, 1e-9) / 1e6 << " M rows/s)\n";
+            params.particles_per_arm = 0;
+            params.core_particles = 0;
+        }
+        
+        Galaxy galaxy(grid.width, grid.height, params);
+        galaxy.add_particles(move(imported));
+        
+        const string& path = options.export_catalog.empty() ? options.export_snapshot : options.export_catalog;
+        bool written = options.export_catalog.empty() ? Snapshot::write(path, galaxy.particles())
+                                                      : write_catalog(path, galaxy.particles());
+        if (!written) {
+            cerr << "Failed to write " << path << '\n';
+            return 1;
+        }
+        if (options.export_catalog.empty() && !Snapshot::verify(path, galaxy.particles())) {
+            cerr << path << " does not read back within snapshot precision\n";
+            return 1;
+        }
+        cerr << galaxy.particles().size() << " particles -> " << path << '\n';
+        return 0;
+    }
+    
+#ifndef _WIN32
+    // SHA-1 is only needed for the WebSocket handshake.
+    array<uint8_t, 20> sha1(string_view data) {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+        string message(data);
+        uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+        message += static_cast<char>(0x80);
+        while (message.size() % 64 != 56) message += '\0';
+        for (int i = 7; i >= 0; --i) message += static_cast<char>(bits >> (i * 8));
+        
+        for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i) {
+                const auto* p = reinterpret_cast<const uint8_t*>(&message[chunk + i * 4]);
+                w[i] = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+            }
+            for (int i = 16; i < 80; ++i) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; ++i) {
+                uint32_t f, k;
+                if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+                else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+                else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+                uint32_t t = rotl(a, 5) + f + e + k + w[i];
+                e = d; d = c; c = rotl(b, 30); b = a; a = t;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+        
+        array<uint8_t, 20> digest;
+        for (int i = 0; i < 20; ++i) digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - (i % 4) * 8));
+        return digest;
+    }
+    
+    string base64_encode(const uint8_t* data, size_t size) {
+        static constexpr char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        string out;
+        for (size_t i = 0; i < size; i += 3) {
+            uint32_t n = uint32_t(data[i]) << 16;
+            if (i + 1 < size) n |= uint32_t(data[i + 1]) << 8;
+            if (i + 2 < size) n |= data[i + 2];
+            out += ALPHABET[n >> 18 & 63];
+            out += ALPHABET[n >> 12 & 63];
+            out += i + 1 < size ? ALPHABET[n >> 6 & 63] : '=';
+            out += i + 2 < size ? ALPHABET[n & 63] : '=';
+        }
+        return out;
+    }
+    
+    // Served at "/". Frames arrive as
+    //   u8 kind (0 key, 1 delta), u16 width, u16 height, u32 frame number,
+    //   then runs of (varint cells to skip, varint length, length bytes)
+    // patching the previous frame, all little endian.
+    constexpr string_view VIEWER_HTML = R"html(<!DOCTYPE html>
+<html><head><meta charset="utf-8"><title>Spiralis</title>
+<style>body{margin:0;background:#000;color:#888;font:12px monospace}
+canvas{display:block;width:100vw;height:calc(100vh - 16px);object-fit:contain;image-rendering:pixelated}</style>
+</head><body><canvas id="c"></canvas><div id="s">connecting</div><script>
+const canvas = document.getElementById('c'), status = document.getElementById('s');
+const ctx = canvas.getContext('2d');
+const palette = new Uint32Array(256);
+for (let v = 0; v < 256; v++) {
+  const t = v / 255, r = Math.min(255, 80 + 400 * t), g = Math.min(255, 60 + 320 * t * t), b = Math.min(255, 160 + 200 * t);
+  palette[v] = v ? 0xff000000 | b << 16 | g << 8 | r : 0xff000000;
+}
+let cells = null, image = null, pixels = null;
+const ws = new WebSocket('ws://' + location.host + '/ws');
+ws.binaryType = 'arraybuffer';
+ws.onclose = () => status.textContent = 'disconnected';
+ws.onmessage = (e) => {
+  const bytes = new Uint8Array(e.data), view = new DataView(e.data);
+  const kind = bytes[0], w = view.getUint16(1, true), h = view.getUint16(3, true);
+  if (!cells || kind === 0 && cells.length !== w * h) {
+    canvas.width = w; canvas.height = h;
+    cells = new Uint8Array(w * h);
+    image = ctx.createImageData(w, h);
+    pixels = new Uint32Array(image.data.buffer);
+  }
+  if (kind === 0) cells.fill(0);
+  let p = 9, cell = 0;
+  const varint = () => { let v = 0, s = 0, b; do { b = bytes[p++]; v |= (b & 127) << s; s += 7; } while (b & 128); return v; };
+  while (p < bytes.length) {
+    cell += varint();
+    const n = varint();
+    cells.set(bytes.subarray(p, p + n), cell);
+    p += n; cell += n;
+  }
+  for (let i = 0; i < cells.length; i++) pixels[i] = palette[cells[i]];
+  ctx.putImageData(image, 0, 0);
+  status.textContent = 'frame ' + view.getUint32(5, true) + '  ' + w + 'x' + h + '  ' + bytes.length + ' bytes';
+};
+</script></body></html>
+)html";
+    
+    // Serves the viewer page and streams one simulation to every connected
+    // browser on localhost. Each frame is quantized and delta-encoded once,
+    // then the same message goes to all viewers; a viewer that falls behind
+    // skips frames and resynchronizes with a key frame.
+    class ViewerServer {
+    private:
+        struct Client {
+            int fd = -1;
+            bool upgraded = false;
+            bool needs_key = true;
+            string request{};
+            // Bytes received after the upgrade, up to the last whole frame.
+            string incoming{};
+            string pending{};
+        };
+        
+        static constexpr size_t MAX_PENDING = 1 << 20;
+        // Viewers only send control frames, whose payloads are at most 125
+        // bytes; anything larger is not a viewer.
+        static constexpr uint64_t MAX_CLIENT_PAYLOAD = 125;
+        
+        int listen_fd_ = -1;
+        vector<Client> clients_;
+        vector<uint8_t> previous_;
+        uint32_t frame_number_ = 0;
+        
+        static void put_varint(string& out, size_t value) {
+            while (value >= 128) {
+                out += static_cast<char>((value & 127) | 128);
+                value >>= 7;
+            }
+            out += static_cast<char>(value);
+        }
+        
+        // Runs of cells differing from base; unchanged gaps shorter than a
+        // run header are folded into the run.
+        static string encode(uint8_t kind, int width, int height, uint32_t frame,
+                             const vector<uint8_t>& cells, const vector<uint8_t>& base) {
+            string out;
+            out += static_cast<char>(kind);
+            for (int b = 0; b < 2; ++b) out += static_cast<char>(width >> (b * 8));
+            for (int b = 0; b < 2; ++b) out += static_cast<char>(height >> (b * 8));
+            for (int b = 0; b < 4; ++b) out += static_cast<char>(frame >> (b * 8));
+            
+            size_t last = 0;
+            for (size_t i = 0; i < cells.size();) {
+                if (cells[i] == base[i]) {
+                    ++i;
+                    continue;
+                }
+                size_t end = i + 1;
+                for (size_t gap = 0; end < cells.size() && gap < 4; ++end) {
+                    gap = cells[end] == base[end] ? gap + 1 : 0;
+                }
+                while (end > i + 1 && cells[end - 1] == base[end - 1]) --end;
+                put_varint(out, i - last);
+                put_varint(out, end - i);
+                out.append(reinterpret_cast<const char*>(&cells[i]), end - i);
+                last = i = end;
+            }
+            return out;
+        }
+        
+        // Binary frames by default; opcode 0x8 closes and 0xA pongs.
+        static string websocket_frame(const string& payload, uint8_t opcode = 0x2) {
+            string header(1, static_cast<char>(0x80 | opcode));
+            size_t size = payload.size();
+            if (size < 126) {
+                header += static_cast<char>(size);
+            } else if (size <= 0xFFFF) {
+                header += static_cast<char>(126);
+                for (int b = 1; b >= 0; --b) header += static_cast<char>(size >> (b * 8));
+            } else {
+                header += static_cast<char>(127);
+                for (int b = 7; b >= 0; --b) header += static_cast<char>(static_cast<uint64_t>(size) >> (b * 8));
+            }
+            return header + payload;
+        }
+        
+        // Queues bytes and writes what the socket accepts without blocking.
+        static bool send_pending(Client& client) {
+            while (!client.pending.empty()) {
+                ssize_t n = send(client.fd, client.pending.data(), client.pending.size(), MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+                if (n <= 0) return false;
+                client.pending.erase(0, n);
+            }
+            return true;
+        }
+        
+        static string http_response(string_view status, string_view type, string_view body) {
+            string out = "HTTP/1.1 ";
+            out += status;
+            out += "\r\nContent-Type: ";
+            out += type;
+            out += "\r\nContent-Length: " + to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+            out += body;
+            return out;
+        }
+        
+        static string header_value(const string& request, string_view name) {
+            for (size_t pos = request.find("\r\n"); pos != string::npos; pos = request.find("\r\n", pos + 2)) {
+                size_t colon = request.find(':', pos + 2);
+                size_t end = request.find("\r\n", pos + 2);
+                if (colon == string::npos || colon > end || colon - (pos + 2) != name.size()) continue;
+                bool match = equal(name.begin(), name.end(), request.begin() + pos + 2, [](char a, char b) {
+                    return tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b));
+                });
+                if (!match) continue;
+                size_t start = request.find_first_not_of(' ', colon + 1);
+                return request.substr(start, end - start);
+            }
+            return "";
+        }
+        
+        // Returns false when the connection should be closed.
+        bool handle_request(Client& client) {
+            size_t end = client.request.find("\r\n\r\n");
+            if (end == string::npos) return client.request.size() < 8192;
+            
+            string key = header_value(client.request, "Sec-WebSocket-Key");
+            if (client.request.rfind("GET /ws ", 0) == 0 && !key.empty()) {
+                auto digest = sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+                client.pending += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                                  "Connection: Upgrade\r\nSec-WebSocket-Accept: " +
+                                  base64_encode(digest.data(), digest.size()) + "\r\n\r\n";
+                client.upgraded = true;
+                // Frames may already follow the handshake in the same read.
+                client.incoming = client.request.substr(end + 4);
+                client.request.clear();
+                return send_pending(client) && handle_frames(client);
+            }
+            if (client.request.rfind("GET / ", 0) == 0) {
+                client.pending += http_response("200 OK", "text/html; charset=utf-8", VIEWER_HTML);
+            } else {
+                client.pending += http_response("404 Not Found", "text/plain", "not found\n");
+            }
+            // Plain HTTP requests are answered and closed.
+            send_pending(client);
+            return false;
+        }
+        
+        // Parses every whole frame in client.incoming: header, length, mask,
+        // then payload. A frame split across reads waits for the rest. Pings
+        // are answered and a close is echoed before the connection ends;
+        // anything else is ignored. Returns false to close the connection.
+        bool handle_frames(Client& client) {
+            const string& in = client.incoming;
+            size_t pos = 0;
+            while (in.size() - pos >= 2) {
+                auto byte = [&](size_t i) { return static_cast<uint8_t>(in[pos + i]); };
+                uint8_t opcode = byte(0) & 0x0F;
+                bool masked = byte(1) & 0x80;
+                uint64_t length = byte(1) & 0x7F;
+                size_t header = 2;
+                if (length == 126) header = 4;
+                else if (length == 127) header = 10;
+                if (in.size() - pos < header) break;
+                if (header > 2) {
+                    length = 0;
+                    for (size_t i = 2; i < header; ++i) length = length << 8 | byte(i);
+                }
+                if (length > MAX_CLIENT_PAYLOAD) return false;
+                size_t mask_at = header;
+                if (masked) header += 4;
+                if (in.size() - pos < header + length) break;
+                
+                string payload = in.substr(pos + header, length);
+                if (masked) {
+                    for (size_t i = 0; i < payload.size(); ++i) payload[i] ^= in[pos + mask_at + i % 4];
+                }
+                pos += header + length;
+                if (opcode == 0x8) {
+                    client.pending += websocket_frame(payload.substr(0, 2), 0x8);
+                    send_pending(client);
+                    return false;
+                }
+                if (opcode == 0x9) client.pending += websocket_frame(payload, 0xA);
+            }
+            client.incoming.erase(0, pos);
+            return true;
+        }
+        
+        // EOF or a close frame ends a viewer.
+        bool handle_readable(Client& client) {
+            char buffer[4096];
+            ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+            if (n < 0) return errno == EAGAIN || errno == EINTR;
+            if (n == 0) return false;
+            if (client.upgraded) {
+                client.incoming.append(buffer, n);
+                return handle_frames(client);
+            }
+            client.request.append(buffer, n);
+            return handle_request(client);
+        }
+        
+    public:
+        ~ViewerServer() {
+            for (auto& client : clients_) close(client.fd);
+            if (listen_fd_ >= 0) close(listen_fd_);
+        }
+        
+        bool listen_on(int port) {
+            listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+            if (listen_fd_ < 0) return false;
+            int yes = 1;
+            setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            return bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+                   listen(listen_fd_, 16) == 0 && fcntl(listen_fd_, F_SETFL, O_NONBLOCK) == 0;
+        }
+        
+        size_t viewers() const {
+            return count_if(clients_.begin(), clients_.end(), [](const Client& c) { return c.upgraded; });
+        }
+        
+        // Accepts connections and services sockets until the deadline.
+        void poll_until(chrono::steady_clock::time_point deadline) {
+            do {
+                vector<pollfd> fds{{listen_fd_, POLLIN, 0}};
+                for (auto& client : clients_) {
+                    fds.push_back({client.fd, static_cast<short>(POLLIN | (client.pending.empty() ? 0 : POLLOUT)), 0});
+                }
+                auto wait = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+                if (poll(fds.data(), fds.size(), max<int>(0, static_cast<int>(wait.count()))) < 0 && errno != EINTR) return;
+                
+                vector<bool> keep(clients_.size(), true);
+                for (size_t i = 0; i < clients_.size(); ++i) {
+                    short events = fds[i + 1].revents;
+                    if (events & (POLLERR | POLLHUP)) keep[i] = false;
+                    if (keep[i] && events & POLLIN) keep[i] = handle_readable(clients_[i]);
+                    if (keep[i] && events & POLLOUT) keep[i] = send_pending(clients_[i]);
+                }
+                for (size_t i = clients_.size(); i-- > 0;) {
+                    if (keep[i]) continue;
+                    close(clients_[i].fd);
+                    clients_.erase(clients_.begin() + i);
+                }
+                
+                if (fds[0].revents & POLLIN) {
+                    int fd;
+                    while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0) {
+                        fcntl(fd, F_SETFL, O_NONBLOCK);
+                        clients_.push_back({fd});
+                    }
+                }
+            } while (chrono::steady_clock::now() < deadline && !quit_requested);
+        }
+        
+        // Quantizes the plane and sends it to every viewer, as a delta
+        // against the previous frame or as a key frame for viewers that
+        // just joined or fell behind.
+        void broadcast(const IntensityPlane& plane) {
+            vector<uint8_t> cells(plane.cells.size());
+            for (size_t i = 0; i < cells.size(); ++i) {
+                cells[i] = static_cast<uint8_t>(clamp(plane.cells[i] * 160.0f, 0.0f, 255.0f));
+            }
+            if (previous_.size() != cells.size()) previous_.assign(cells.size(), 0);
+            
+            string delta, key;
+            for (auto& client : clients_) {
+                if (!client.upgraded) continue;
+                if (client.pending.size() > MAX_PENDING) {
+                    client.needs_key = true;
+                    continue;
+                }
+                string& message = client.needs_key ? key : delta;
+                if (message.empty()) {
+                    const vector<uint8_t> blank(client.needs_key ? cells.size() : 0);
+                    message = websocket_frame(encode(client.needs_key ? 0 : 1, plane.width, plane.height,
+                                                     frame_number_, cells, client.needs_key ? blank : previous_));
+                }
+                client.pending += message;
+                client.needs_key = false;
+                send_pending(client);
+            }
+            previous_ = move(cells);
+            ++frame_number_;
+        }
+    };
+    
+    int run_serve(const Options& options) {
+        const SweepOptions& grid = options.sweep_options;
+        ViewerServer server;
+        if (!server.listen_on(options.serve_port)) {
+            cerr << "Cannot listen on port " << options.serve_port << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+        signal(SIGINT, [](int) { quit_requested = true; });
+        signal(SIGPIPE, SIG_IGN);
+        
+        // Fit the galaxy's ~18 unit radius into the canvas height.
+        const int width = min(options.canvas_width, 4096);
+        const int height = min(options.canvas_height, 4096);
+        GalaxyParams params = first_grid_params(grid);
+        params.gas_particles = options.gas_particles;
+        Galaxy galaxy(width, height, params);
+        galaxy.set_projection(height / 40.0, 1.0);
+        ThreadPool pool(grid.threads);
+        galaxy.set_thread_pool(&pool);
+        galaxy.set_reorder(options.reorder);
+        
+        cerr << "Serving " << width << "x" << height << " on http://127.0.0.1:" << options.serve_port << "/\n";
+        constexpr double dt = 0.1;
+        auto next_frame = chrono::steady_clock::now();
+        IntensityPlane plane(width, height);
+        while (!quit_requested) {
+            // Nobody watching: keep serving sockets but skip the simulation.
+            if (server.viewers() > 0) {
+                fill(plane.cells.begin(), plane.cells.end(), 0.0f);
+                galaxy.accumulate(plane, 0);
+                server.broadcast(plane);
+                galaxy.update(dt);
+            }
+            next_frame += FRAME_DURATION;
+            auto now = chrono::steady_clock::now();
+            if (next_frame < now) next_frame = now;
+            server.poll_until(next_frame);
+        }
+        return 0;
+    }
+#endif
+    
+    int run_interactive(const Options& options) {
+        // Workers generate their own procedural slices and the coordinator
+        // only gathers them, so a catalog it maps or stars it imports would
+        // never be drawn.
+        if (options.workers > 0 && (!options.catalog.empty() || !options.import_path.empty())) {
+            cerr << (options.catalog.empty() ? "--import" : "--catalog") << " cannot be combined with --workers\n";
+            return 1;
+        }
+        
+        ParticleStore imported;
+        if (!options.import_path.empty() &&
+            !import_particles(options.import_path, options.sweep_options.threads, imported)) {
+            cerr << "Cannot read " << options.import_path << '\n';
+            return 1;
+        }
+        
+        unique_ptr<OutputSink> sink = open_output(options.output);
+        if (!sink) {
+            cerr << "Cannot open output " << options.output << '\n';
+            return 1;
+        }
+        
+        signal(SIGINT, [](int) { quit_requested = true; });
+        
+        if (sink->interactive()) {
+            hide_cursor();
+            clear_screen();
+        }
+        enable_terminal_input(sink->interactive());
+        
+        int term_width, term_height;
+        get_terminal_size(term_width, term_height);
+        
+        int width = min(term_width, 120);
+        int height = min(term_height - 3, 35);
+        
+        GalaxyParams params;
+        params.gas_particles = options.gas_particles;
+#ifndef _WIN32
+        unique_ptr<ShardCoordinator> shards;
+        if (options.workers > 0) {
+            shards = make_unique<ShardCoordinator>(width, height, params, options.workers);
+            // The coordinator keeps the background and core overlay only.
+            params.shard_count = options.workers;
+            params.shard_index = options.workers;
+        }
+        double pending_advance = 0;
+#endif
+#ifndef _WIN32
+        shared_ptr<MappedCatalog> catalog;
+        if (!options.catalog.empty()) {
+            catalog = MappedCatalog::open(options.catalog);
+            if (!catalog) {
+                restore_terminal();
+                cerr << "Cannot map catalog " << options.catalog << '\n';
+                return 1;
+            }
+            // A catalog replaces the procedural particles.
+            params.particles_per_arm = 0;
+            params.core_particles = 0;
+        }
+#endif
+        if (!options.import_path.empty()) {
+            params.particles_per_arm = 0;
+            params.core_particles = 0;
+        }
+        Galaxy galaxy(width, height, params);
+        galaxy.add_particles(move(imported));
+        galaxy.set_output(sink.get());
+        ThreadPool pool(options.sweep_options.threads);
+        galaxy.set_thread_pool(&pool);
+        galaxy.set_reorder(options.reorder);
+#ifndef _WIN32
+        if (catalog) galaxy.attach_catalog(catalog);
+#endif
+        
+        constexpr double dt = 0.1;
+        auto start_time = chrono::steady_clock::now();
+        auto next_frame = start_time;
+        QualityController quality(chrono::duration<double, milli>(FRAME_DURATION).count());
+        TerminalEvents events;
+        LatencyTracer latency(start_time);
+        if (!options.latency_log.empty() && !latency.open_log(options.latency_log)) {
+            restore_terminal();
+            cerr << "Cannot write " << options.latency_log << '\n';
+            return 1;
+        }
+        uint64_t frame_number = 0;
+        auto ticked = start_time;
+        
+        while (!quit_requested && sink->good()) {
+            poll_terminal_events(events);
+            if (events.pan_x != 0 || events.pan_y != 0) {
+                // Cells are about twice as tall as wide; pan further sideways.
+                // Steps are one screen cell at the current zoom.
+                Vec2 camera = galaxy.camera();
+                double step = 1 << galaxy.zoom();
+                galaxy.set_camera({camera.x + events.pan_x * 2.0 * step, camera.y + events.pan_y * step});
+                events.pan_x = events.pan_y = 0;
+            }
+            if (events.zoom != 0) {
+                galaxy.set_zoom(galaxy.zoom() + events.zoom);
+                events.zoom = 0;
+            }
+            
+            // While the terminal is in the background nobody is watching, so
+            // tick rarely and advance the simulation by the skipped time.
+            int frames = events.focused ? 1 : UNFOCUSED_FRAME_INTERVAL;
+            
+            auto now = chrono::steady_clock::now();
+            double real_elapsed = chrono::duration<double>(now - start_time).count();
+            RenderStats stats;
+            double sim_time = galaxy.time();
+#ifndef _WIN32
+            if (shards) {
+                // Workers step their shards at the start of the gather.
+                IntensityPlane intensity(width, height);
+                auto stage_start = chrono::steady_clock::now();
+                ticked = stage_start;
+                sim_time += pending_advance;
+                if (!shards->gather(pending_advance, galaxy.camera(), quality.level(), galaxy.zoom(), intensity)) break;
+                stats.accumulate_ms = elapsed_ms(stage_start);
+                stats.accumulated = chrono::steady_clock::now();
+                galaxy.present(intensity, real_elapsed, quality.level(), stats);
+                pending_advance = dt * frames;
+            } else
+#endif
+            stats = galaxy.render(real_elapsed, quality.level());
+            if (!stats.output_skipped) {
+                quality.report(stats);
+                latency.record({frame_number, sim_time, ticked, stats.accumulated, stats.shaded, stats.written});
+                galaxy.set_status(latency.hud());
+            }
+            ++frame_number;
+            
+            galaxy.update(dt * frames);
+            ticked = chrono::steady_clock::now();
+            
+            // Sleep only for what is left of the frame so render cost does not
+            // stretch the cadence; after a long stall resynchronize instead of
+            // bursting to catch up.
+            next_frame += FRAME_DURATION * frames;
+            now = chrono::steady_clock::now();
+            if (next_frame < now) next_frame = now;
+            this_thread::sleep_until(next_frame);
+        }
+        
+        restore_terminal();
+        if (sink->interactive()) cout << '\n';
+        if (!sink->good()) cerr << "Output " << options.output << " closed\n";
+        latency.report(cerr);
+        return 0;
     }
+}
 
+#ifdef __EMSCRIPTEN__
+// Entry points for the WebAssembly module. spiralis_accumulate returns a
+// pointer into linear memory, so JavaScript reads the plane through a
+// Float32Array view without copying; it stays valid until the next call
+// that allocates.
+namespace {
+    struct WasmGalaxy {
+        Galaxy galaxy;
+        IntensityPlane plane;
+    };
+}
+
+extern "C" {
+EMSCRIPTEN_KEEPALIVE void* spiralis_create(int width, int height, uint32_t seed, int arms, int particles_per_arm) {
+    GalaxyParams params;
+    params.seed = seed;
+    params.num_arms = max(arms, 1);
+    params.particles_per_arm = max(particles_per_arm, 0);
+    return new WasmGalaxy{Galaxy(width, height, params), IntensityPlane(width, height)};
+}
+
+EMSCRIPTEN_KEEPALIVE void spiralis_destroy(void* handle) { delete static_cast<WasmGalaxy*>(handle); }
+
+EMSCRIPTEN_KEEPALIVE int spiralis_has_simd() {
+#ifdef __wasm_simd128__
+    return 1;
+#else
     return 0;
-}
\ No newline at end of file
+#endif
+}
+
+EMSCRIPTEN_KEEPALIVE void spiralis_set_simd(void* handle, int enabled) {
+    static_cast<WasmGalaxy*>(handle)->galaxy.set_simd(enabled != 0);
+}
+
+EMSCRIPTEN_KEEPALIVE double spiralis_particles(void* handle) {
+    return static_cast<double>(static_cast<WasmGalaxy*>(handle)->galaxy.particles().size());
+}
+
+EMSCRIPTEN_KEEPALIVE void spiralis_update(void* handle, double dt) { static_cast<WasmGalaxy*>(handle)->galaxy.update(dt); }
+
+EMSCRIPTEN_KEEPALIVE const float* spiralis_accumulate(void* handle) {
+    auto* wasm = static_cast<WasmGalaxy*>(handle);
+    fill(wasm->plane.cells.begin(), wasm->plane.cells.end(), 0.0f);
+    wasm->galaxy.accumulate(wasm->plane, 0);
+    return wasm->plane.cells.data();
+}
+}
+#endif
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+    
+    if (options.sweep) return run_sweep(options.sweep_options);
+    if (options.bench) return run_bench(options);
+    if (options.bench_matrix) return run_bench_matrix(options);
+    if (options.bench_queues) return run_bench_queues(options);
+    if (options.bench_snapshots) return run_bench_snapshots(options);
+    if (options.bench_console) return run_bench_console(options);
+    if (options.bench_accumulate) return run_bench_accumulate(options);
+    if (options.bench_sort) return run_bench_sort(options);
+    if (options.bench_reorder) return run_bench_reorder(options);
+    if (options.bench_neighbours) return run_bench_neighbours(options);
+#ifndef _WIN32
+    if (options.serve_port > 0) return run_serve(options);
+#endif
+    if (!options.export_catalog.empty() || !options.export_snapshot.empty()) return run_export(options);
+    return run_interactive(options);
+}
@@ -0,0 +1,48 @@
+// Headless benchmark of the WebAssembly build: scalar vs. SIMD128 particle
+// kernels on the same galaxy. Run from the Emscripten build directory:
+//   node wasm_bench.mjs [particles per arm] [frames]
+import createSpiralis from './Spiralis.mjs';
+
+const particlesPerArm = Number(process.argv[2] ?? 200000);
+const frames = Number(process.argv[3] ?? 100);
+const width = 120;
+const height = 40;
+
+const module = await createSpiralis();
+const galaxy = module._spiralis_create(width, height, 42, 2, particlesPerArm);
+const particles = module._spiralis_particles(galaxy);
+
+// Reads the plane straight out of linear memory; the view is rebuilt every
+// call because memory growth replaces the underlying buffer.
+function intensity(pointer) {
+  return new Float32Array(module.HEAPF32.buffer, pointer, width * height);
+}
+
+function run(simd) {
+  module._spiralis_set_simd(galaxy, simd);
+  let update = 0;
+  let accumulate = 0;
+  let total = 0;
+  for (let f = 0; f < frames; f++) {
+    let start = performance.now();
+    module._spiralis_update(galaxy, 0.1);
+    update += performance.now() - start;
+    start = performance.now();
+    const plane = intensity(module._spiralis_accumulate(galaxy));
+    accumulate += performance.now() - start;
+    for (let i = 0; i < plane.length; i++) total += plane[i];
+  }
+  return { update, accumulate, total };
+}
+
+console.log(`${particles} particles, ${width}x${height}, ${frames} frames`);
+const variants = module._spiralis_has_simd() ? [0, 1] : [0];
+if (variants.length === 1) console.log('SIMD128 kernels not compiled in, scalar only');
+for (const simd of variants) {
+  const { update, accumulate, total } = run(simd);
+  const rate = (ms) => (particles * frames / ms / 1e3).toFixed(1);
+  console.log(`${simd ? 'simd128' : 'scalar '}  update ${(update / frames).toFixed(3)} ms/frame ` +
+              `(${rate(update)} M/s)  accumulate ${(accumulate / frames).toFixed(3)} ms/frame ` +
+              `(${rate(accumulate)} M/s)  brightness ${total.toFixed(0)}`);
+}
+module._spiralis_destroy(galaxy);